@@ -0,0 +1,63 @@
+#!/bin/sh
+# Press-to-IR latency benchmark: builds the simulator for each combination
+# of MSI_CLK_DIV, MSI_BURST_DIV, LPTIM_CLK_DIV and SYS_IRQ_DRIVEN, runs the same
+# button script against each, and reports the mean and worst latency from press
+# to the first carrier edge, with the wakes, the time awake and the charge drawn
+# above idle, per press.
+#
+#   ./bench.sh                                  default sweep
+#   MSI="4 16" LPTIM="1 32" ./bench.sh          chosen values
+#   MSI=16 BURST="0 1 4" LPTIM=32 ./bench.sh    wake bursts against the fixed clock
+#   MSI=16 LPTIM=32 IRQ="0 1" ./bench.sh        superloop against interrupt-driven
+#   FWDEFS="-DSYS_STATS=1" ./bench.sh           other config overrides
+#   SIMOPTS="-i 0" ./bench.sh                   other simulator options, e.g.
+#                                               no IRED current
+#
+# The script presses each button once, with contact bounce, and holds button 1
+# long enough to auto-repeat.
+
+MSI=${MSI:-"1 2 4 8 16 32 64"}
+BURST=${BURST:-0}
+LPTIM=${LPTIM:-"1 4 16 32 128"}
+IRQ=${IRQ:-0}
+BOUNCES=${BOUNCES:-3}
+SCRIPT=${SCRIPT:-"-p 0:100:250 -p 1:600:1500 -p 2:1800:1900 -p 3:2300:2400 -t 2800"}
+SIMOPTS=${SIMOPTS:-}
+
+cd "$(dirname "$0")" || exit 1
+# builds are kept per set of overrides, so that a change of FWDEFS rebuilds
+defs=$(printf "%s" "$FWDEFS" | cksum | cut -d " " -f 1)
+printf "%7s  %9s  %9s  %3s  %9s  %8s  %11s  %11s  %12s  %14s  %15s\n" \
+	msi_div burst_div lptim_div irq sysclk_hz tick_hz latency_ms worst_ms wakes/press awake_us/press charge_uC/press
+for m in $MSI; do
+	for b in $BURST; do
+		for l in $LPTIM; do
+			for i in $IRQ; do
+				build="build/bench/$defs/msi$m-burst$b-lptim$l-irq$i"
+				mkdir -p "$build"
+				if ! make -s BUILD="$build" FWDEFS="-DMSI_CLK_DIV=$m -DMSI_BURST_DIV=$b -DLPTIM_CLK_DIV=$l -DSYS_IRQ_DRIVEN=$i $FWDEFS" >"$build.log" 2>&1; then
+					printf "%7s  %9s  %9s  %3s  build failed, see %s\n" "$m" "$b" "$l" "$i" "$build.log"
+					continue
+				fi
+				"./$build/fanirrc_sim" -b "$BOUNCES" $SCRIPT $SIMOPTS | awk -v m="$m" -v b="$b" -v l="$l" -v i="$i" '
+					$1 ~ /^[0-9]+$/ {
+						presses++
+						wakes += $5
+						awake += $6
+						charge += $7
+						if ($3 != "-") {
+							sent++
+							lat += $3
+							if ($3 > worst)
+								worst = $3
+						}
+					}
+					END {
+						printf "%7d  %9d  %9d  %3d  %9d  %8.1f  %11s  %11s  %12.1f  %14.1f  %15.4f\n", m, b, l, i, 4194304 / m, 37000 / l,
+							sent ? sprintf("%.3f", lat / sent / 1000) : "-", sent ? sprintf("%.3f", worst / 1000) : "-",
+							wakes / presses, awake / presses, charge / presses
+					}'
+			done
+		done
+	done
+done
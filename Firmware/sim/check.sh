@@ -0,0 +1,88 @@
+#!/bin/sh
+# Frame check: builds the simulator for each configuration below, runs its
+# button script with a trace, decodes the IR envelope (ir_level) from the trace
+# and compares the frames with the golden ones in golden/<case>.txt.
+#
+#   ./check.sh                  check every case
+#   CASES="default irq" ./check.sh
+#   UPDATE=1 ./check.sh         rewrite the golden frames, after checking the
+#                               new ones by other means
+#
+# Each frame is one line: the space before it, in us, then its marks and spaces
+# in us.  Frames are split at spaces of more than 10ms, and the space before a
+# frame is only given, otherwise '-', when the transmission was in progress
+# throughout, since only then is it timed by the IR engine rather than by when
+# the buttons were pressed.  A line 'tx' marks the start of each transmission.
+
+CASES=${CASES:-"default irq preempt macro speculative streaming protocols"}
+BOUNCES=${BOUNCES:-3}
+SCRIPT="-p 0:100:250 -p 1:600:1500 -p 2:1800:1900 -p 3:2300:2400 -t 2800"
+
+cd "$(dirname "$0")" || exit 1
+failed=0
+for c in $CASES; do
+	script=$SCRIPT
+	case $c in
+		default)		defs="" ;;
+		irq)				defs="-DSYS_IRQ_DRIVEN=1" ;;
+		preempt)		defs="-DSYS_PREEMPT=1"; script="-p 3:100:200 -p 0:210:310 -t 900" ;;
+		macro)			defs="-DSYS_MACROS=1 -DBUTTON_MATRIX_COLS=2"; script="-p 4:100:200 -p 1:1500:1600 -t 2000" ;;
+		speculative)	defs="-DSYS_SPECULATIVE=1" ;;
+		streaming)		defs="-DIR_PREBUILT=0" ;;
+		protocols)		defs="-DIR_CMD0_PROTOCOL=IR_PROTO_NEC -DIR_CMD0_CODE=0xf708fb04 -DIR_CMD1_PROTOCOL=IR_PROTO_SIRC12 -DIR_CMD1_CODE=0x95 \
+							-DIR_CMD2_PROTOCOL=IR_PROTO_RC5 -DIR_CMD2_CODE=0x300c -DIR_CMD3_PROTOCOL=IR_PROTO_RC6 -DIR_CMD3_CODE=0x10000c" ;;
+		*)				echo "$c: no such case"; failed=1; continue ;;
+	esac
+	build="build/check/$c"
+	mkdir -p "$build"
+	if ! make -s BUILD="$build" FWDEFS="$defs" >"$build.log" 2>&1; then
+		echo "$c: build failed, see $build.log"
+		failed=1
+		continue
+	fi
+	"./$build/fanirrc_sim" -b "$BOUNCES" $script -o "$build/trace.vcd" >"$build/report.txt" || {
+		echo "$c: simulation failed"
+		failed=1
+		continue
+	}
+	awk '
+		function flush() {
+			if (frame != "")
+				print frame
+			frame = ""
+		}
+		BEGIN { level = "0" }
+		/^#/ { t = substr($0, 2); next }
+		$0 == "1$" { flush(); print "tx"; tx = 1; next }
+		$0 == "0$" { tx = 0; held = 0; next }
+		($0 == "1\"" || $0 == "0\"") && (substr($0, 1, 1) != level) {
+			us = int((t - since) / 1000 + 0.5)
+			if (level == "1") {
+				frame = frame " " us
+				held = tx
+			} else if (frame == "") {
+				frame = "-"
+			} else if (us <= 10000) {
+				frame = frame " " us
+			} else {
+				gap = held ? us : "-"
+				flush()
+				frame = gap
+			}
+			level = substr($0, 1, 1)
+			since = t
+		}
+		END { flush() }
+	' "$build/trace.vcd" >"$build/frames.txt"
+	if [ -n "$UPDATE" ]; then
+		mkdir -p golden
+		cp "$build/frames.txt" "golden/$c.txt"
+		echo "$c: updated, $(grep -vc tx "golden/$c.txt") frames"
+	elif diff -u "golden/$c.txt" "$build/frames.txt" >"$build.diff" 2>&1; then
+		echo "$c: ok, $(grep -vc tx "$build/frames.txt") frames"
+	else
+		echo "$c: FAILED, see $build.diff"
+		failed=1
+	fi
+done
+exit $failed
@@ -0,0 +1,46 @@
+#ifndef SIM_INC_CMSIS_HOST_H_
+#define SIM_INC_CMSIS_HOST_H_
+
+/* Pre-included (gcc -include) ahead of the device headers in the host build.
+ * It claims the include guard of the CMSIS compiler abstraction, so that the
+ * ARM-specific cmsis_gcc.h is never seen, and routes the core intrinsics that
+ * the firmware uses to the simulated CPU.
+ * */
+
+#define __CMSIS_COMPILER_H
+
+#include	<stdint.h>
+
+#define	__ASM												__asm
+#define	__INLINE										inline
+#define	__STATIC_INLINE							static inline
+#define	__STATIC_FORCEINLINE				static inline
+#define	__NO_RETURN									__attribute__((__noreturn__))
+#define	__USED											__attribute__((used))
+#define	__WEAK											__attribute__((weak))
+#define	__PACKED										__attribute__((packed, aligned(1)))
+#define	__PACKED_STRUCT							struct __attribute__((packed, aligned(1)))
+#define	__PACKED_UNION							union __attribute__((packed, aligned(1)))
+#define	__ALIGNED(x)								__attribute__((aligned(x)))
+#define	__RESTRICT									__restrict
+#define	__COMPILER_BARRIER()				__asm volatile("" ::: "memory")
+
+void Cpu_SEV(void);
+void Cpu_WFE(void);
+void Cpu_WFI(void);
+void Cpu_SetPRIMASK(uint32_t val);
+uint32_t Cpu_GetPRIMASK(void);
+
+#define	__SEV()											Cpu_SEV()
+#define	__WFE()											Cpu_WFE()
+#define	__WFI()											Cpu_WFI()
+#define	__NOP()											__COMPILER_BARRIER()
+#define	__DSB()											__COMPILER_BARRIER()
+#define	__ISB()											__COMPILER_BARRIER()
+#define	__DMB()											__COMPILER_BARRIER()
+#define	__enable_irq()							Cpu_SetPRIMASK(0)
+#define	__disable_irq()							Cpu_SetPRIMASK(1)
+#define	__get_PRIMASK()							Cpu_GetPRIMASK()
+#define	__set_PRIMASK(x)						Cpu_SetPRIMASK(x)
+
+#endif // SIM_INC_CMSIS_HOST_H_
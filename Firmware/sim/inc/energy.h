@@ -0,0 +1,59 @@
+#ifndef SIM_INC_ENERGY_H_
+#define SIM_INC_ENERGY_H_
+
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+
+/*===============================================
+ public constants
+ ===============================================*/
+
+#define		ENERGY_UC_PER_MAH			(3.6e6)
+#define		ENERGY_S_PER_DAY			(86400.0)
+
+/*===============================================
+ public data prototypes
+ ===============================================*/
+
+typedef enum {
+	EnergyRun = 0,
+	EnergySleep,
+	EnergyStop,
+	EnergyNumStates,
+} EnergyState_t;
+
+/* Figures that are not fixed by the MCU: the IRED drive, the battery and
+ * how the remote is used.  Everything else is in energy.c.
+ * */
+typedef struct {
+	double ired;					// mA, while the IRED is on
+	double capacity;			// mAh
+	double derating;			// usable fraction of capacity, for pulsed load, temperature and self-discharge
+	double pressesPerDay;
+} EnergyModel_t;
+
+typedef struct {
+	double charge;							// uC
+	double time[EnergyNumStates];	// s
+	double tx;									// s, IR engine running
+	double ired;								// s, IRED on
+	double prog;								// s, programming data EEPROM
+} EnergyMeter_t;
+
+/*===============================================
+ public function prototypes
+ ===============================================*/
+
+void Energy_Defaults(EnergyModel_t *model);
+double Energy_Current(const EnergyModel_t *model, EnergyState_t state, uint32_t sysclk, bool tx, bool ired, bool prog);
+void Energy_Add(EnergyMeter_t *meter, const EnergyModel_t *model, double dt, EnergyState_t state, uint32_t sysclk, bool tx, bool ired,
+	bool prog);
+double Energy_Excess(const EnergyModel_t *model, double charge, double time);
+void Energy_Project(FILE *f, const EnergyModel_t *model, double excess);
+
+#endif // SIM_INC_ENERGY_H_
@@ -0,0 +1,86 @@
+#ifndef SIM_INC_SIM_H_
+#define SIM_INC_SIM_H_
+
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+#include	"stm32l0xx.h"
+#include	"config.h"
+#include	"energy.h"
+
+/*===============================================
+ public constants
+ ===============================================*/
+
+#define		SIM_PS_PER_S					(1000000000000ULL)
+#define		SIM_PS_PER_MS					(1000000000ULL)
+#define		SIM_PS_PER_US					(1000000ULL)
+#define		SIM_NEVER							(UINT64_MAX)
+#define		SIM_STOP_WAKEUP				(5 * SIM_PS_PER_US)		// MSI restart and regulator settling on exit from STOP
+#define		SIM_LSI_STARTUP				(100 * SIM_PS_PER_US)
+#define		SIM_EEPROM_PROG				(3200 * SIM_PS_PER_US)	// erase and program of a data EEPROM word
+#define		SIM_IRQ_SYSTICK				(31)									// NVIC has 32 lines; SysTick is mapped onto the last
+#if BUTTON_MATRIX_COLS
+	#define	SIM_NUM_BUTTONS				(BUTTON_MATRIX_ROWS * BUTTON_MATRIX_COLS)
+#else
+	#define	SIM_NUM_BUTTONS				(4)
+#endif
+
+/*===============================================
+ public data prototypes
+ ===============================================*/
+
+/*===============================================
+ public function prototypes
+ ===============================================*/
+
+// sim.c - memory map, scheduler and stimulus
+uint64_t Sim_Now(void);
+uint32_t *Sim_Reg(uintptr_t addr);
+bool Sim_Mapped(uintptr_t addr);
+void Sim_Protect(uintptr_t addr, bool open);
+void Sim_Cycle(void);
+void Sim_Run(uint64_t until, bool deep);
+void Sim_Step(bool deep);
+void Sim_Finish(int status) __attribute__((noreturn));
+
+// register in the simulated peripheral space, accessed without trapping
+#define		SIM_REG(r)						(*Sim_Reg((uintptr_t)&(r)))
+
+// cpu.c - execution, NVIC and sleep modes
+void Cpu_Start(void (*entry)(void)) __attribute__((noreturn));
+void Cpu_Update(void);
+void Cpu_Event(void);
+void Cpu_Pend(int32_t irq);
+uint32_t Cpu_NvicRead(uintptr_t addr);
+void Cpu_NvicWrite(uintptr_t addr, uint32_t val);
+bool Cpu_Asleep(void);
+bool Cpu_Stopped(void);
+uint64_t Cpu_Instructions(void);
+
+// periph.c - peripheral models
+void Periph_Init(uint32_t lsi, double msiError);
+void Periph_Read(uintptr_t addr);
+void Periph_Write(uintptr_t addr, uint32_t old);
+void Periph_SysClk(bool sleeping);
+void Periph_LSI(bool stopped);
+uint32_t Periph_SysClkHz(void);
+uint32_t Periph_LSIHz(void);
+uint32_t Periph_IRQs(bool stopped);
+void Periph_SetButton(int32_t id, bool pressed);
+bool Periph_Button(int32_t id);
+bool Periph_Pin(int32_t port, int32_t pin);
+bool Periph_Programming(void);
+
+// trace.c - VCD output and per-press measurements
+void Trace_Open(const char *path, const EnergyModel_t *model);
+void Trace_Update(void);
+void Trace_Press(int32_t id);
+void Trace_Report(FILE *f);
+void Trace_Finish(void);
+
+#endif // SIM_INC_SIM_H_
@@ -0,0 +1,371 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	"config.h"
+#include	"energy.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		CAPTURE_MAX_TOKEN			(256)
+#define		CAPTURE_MAX_SIGNALS		(256)
+#define		CAPTURE_MAX_PRESSES		(1024)
+#define		CAPTURE_NEVER					(-1.0)
+
+// the signals that the energy model uses, and their names in a simulator trace
+enum {
+	CaptureRun = 0,
+	CaptureTx,
+	CaptureMod,
+	CaptureStop,
+	CaptureBtn0,
+	CaptureNumRoles = CaptureBtn0 + 4,
+};
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+typedef struct {
+	const char *role;
+	char name[CAPTURE_MAX_TOKEN];
+	bool invert;
+	int32_t index; // into the VCD's signals, or -1 if not present
+} CaptureRole_t;
+
+typedef struct {
+	char id[CAPTURE_MAX_TOKEN];
+	char name[CAPTURE_MAX_TOKEN];
+	bool value;
+} CaptureSignal_t;
+
+typedef struct {
+	double start;
+	double firstMod;
+	double lastMod;
+	double run;
+	double charge;
+} CapturePress_t;
+
+typedef struct {
+	EnergyModel_t model;
+	uint32_t sysclk;
+	double gap;
+	double timescale;
+	int32_t numSignals;
+	CaptureSignal_t signals[CAPTURE_MAX_SIGNALS];
+	CaptureRole_t roles[CaptureNumRoles];
+	bool values[CaptureNumRoles];
+	double lastLow[CaptureNumRoles]; // time at which each role last went low
+	EnergyMeter_t meter;
+	double now;
+	int32_t wakes;
+	int32_t numPresses;
+	CapturePress_t presses[CAPTURE_MAX_PRESSES];
+} CaptureConfig_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static void Capture_Usage(const char *name);
+static bool Capture_Map(const char *arg);
+static bool Capture_Token(FILE *f, char *token);
+static bool Capture_Header(FILE *f);
+static double Capture_Timescale(const char *spec);
+static void Capture_Change(const char *id, bool value);
+static void Capture_Advance(double t);
+static void Capture_Edge(int32_t role, bool value);
+static void Capture_Close(void);
+static void Capture_Report(FILE *f);
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static CaptureConfig_t cfg = {
+	.roles = {
+		{ "run", "run" }, { "tx", "tx" }, { "mod", "ir_mod" }, { "stop", "stop" },
+		{ "btn0", "btn0" }, { "btn1", "btn1" }, { "btn2", "btn2" }, { "btn3", "btn3" },
+	},
+};
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+/* Charge per press, and battery life, from a timeline of the RUN, transmit
+ * and IR pins: either a simulator trace (fanirrc_sim -o) or a logic analyser
+ * capture exported as VCD.  The CPU is in RUN while the RUN pin is high, in
+ * SLEEP while it is low and the IR engine is transmitting, and otherwise in
+ * STOP; the IRED is on while the modulated output is high.
+ * */
+int main(int argc, char **argv) {
+	int opt;
+	FILE *f;
+	Energy_Defaults(&cfg.model);
+	cfg.sysclk = SYS_CLK;
+	cfg.gap = 0.2;
+	while ((opt = getopt(argc, argv, "s:f:g:n:i:c:h")) != -1) {
+		switch (opt) {
+			case 's':
+				if (!Capture_Map(optarg)) {
+					Capture_Usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'f':
+				cfg.sysclk = (uint32_t)atol(optarg);
+				break;
+			case 'g':
+				cfg.gap = strtod(optarg, 0) / 1000;
+				break;
+			case 'n':
+				cfg.model.pressesPerDay = strtod(optarg, 0);
+				break;
+			case 'i':
+				cfg.model.ired = strtod(optarg, 0);
+				break;
+			case 'c':
+				cfg.model.capacity = strtod(optarg, 0);
+				break;
+			default:
+				Capture_Usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		Capture_Usage(argv[0]);
+		return 1;
+	}
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (!Capture_Header(f)) {
+		fprintf(stderr, "%s: not a VCD file, or no \"%s\" signal\n", argv[optind], cfg.roles[CaptureRun].name);
+		return 1;
+	}
+	for (int32_t r = 0; r < CaptureNumRoles; r++)
+		cfg.lastLow[r] = -cfg.gap;
+	// value changes
+	char token[CAPTURE_MAX_TOKEN];
+	while (Capture_Token(f, token)) {
+		if (token[0] == '#')
+			Capture_Advance(strtod(token + 1, 0) * cfg.timescale);
+		else if (strchr("01xXzZ", token[0]))
+			Capture_Change(token + 1, token[0] == '1');
+		else if (strchr("bBrR", token[0]))
+			Capture_Token(f, token); // vectors and reals are not used
+	}
+	fclose(f);
+	Capture_Close();
+	Capture_Report(stdout);
+	return 0;
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static void Capture_Usage(const char *name) {
+	fprintf(stderr,
+		"usage: %s [-s role=[!]signal]... [-f sysclk_hz] [-g gap_ms] [-n presses_per_day] [-i ired_ma] [-c battery_mah] trace.vcd\n"
+		"  -s  signal for a role (run, tx, mod, stop, btn0-3); ! inverts, e.g. -s run=PA2 -s btn0=!PA9\n"
+		"  -f  CPU clock while running (default %u)\n"
+		"  -g  a press starts at a button press, or without buttons a wake, after this long idle (default 200ms)\n"
+		"  -n  usage, for the battery life projection\n"
+		"  -i  IRED current while on (mA)\n"
+		"  -c  battery capacity (mAh)\n", name, (unsigned)SYS_CLK);
+}
+
+
+static bool Capture_Map(const char *arg) {
+	const char *eq = strchr(arg, '=');
+	if (!eq)
+		return false;
+	for (int32_t r = 0; r < CaptureNumRoles; r++) {
+		CaptureRole_t *role = &cfg.roles[r];
+		if ((strlen(role->role) != (size_t)(eq - arg)) || strncmp(role->role, arg, eq - arg))
+			continue;
+		role->invert = eq[1] == '!';
+		snprintf(role->name, sizeof(role->name), "%s", eq + 1 + role->invert);
+		return true;
+	}
+	return false;
+}
+
+
+static bool Capture_Token(FILE *f, char *token) {
+	return fscanf(f, "%255s", token) == 1;
+}
+
+
+static bool Capture_Header(FILE *f) {
+	char token[CAPTURE_MAX_TOKEN], spec[2 * CAPTURE_MAX_TOKEN];
+	cfg.timescale = 1e-9;
+	while (Capture_Token(f, token)) {
+		if (!strcmp(token, "$enddefinitions")) {
+			Capture_Token(f, token); // $end
+			break;
+		}
+		if (!strcmp(token, "$timescale")) {
+			spec[0] = 0;
+			while (Capture_Token(f, token) && strcmp(token, "$end"))
+				strncat(spec, token, sizeof(spec) - strlen(spec) - 1);
+			cfg.timescale = Capture_Timescale(spec);
+		}
+		else if (!strcmp(token, "$var") && (cfg.numSignals < CAPTURE_MAX_SIGNALS)) {
+			// $var type size id name [range] $end
+			CaptureSignal_t *s = &cfg.signals[cfg.numSignals++];
+			Capture_Token(f, token);
+			Capture_Token(f, token);
+			Capture_Token(f, s->id);
+			Capture_Token(f, s->name);
+			while (Capture_Token(f, token) && strcmp(token, "$end"));
+		}
+	}
+	for (int32_t r = 0; r < CaptureNumRoles; r++) {
+		cfg.roles[r].index = -1;
+		for (int32_t i = 0; i < cfg.numSignals; i++) {
+			if (!strcmp(cfg.roles[r].name, cfg.signals[i].name))
+				cfg.roles[r].index = i;
+		}
+		cfg.values[r] = cfg.roles[r].invert;
+	}
+	return cfg.roles[CaptureRun].index >= 0;
+}
+
+
+static double Capture_Timescale(const char *spec) {
+	char *unit;
+	double scale = strtod(spec, &unit);
+	if (scale <= 0)
+		scale = 1;
+	switch (unit[0]) {
+		case 's':
+			return scale;
+		case 'm':
+			return scale * 1e-3;
+		case 'u':
+			return scale * 1e-6;
+		case 'n':
+			return scale * 1e-9;
+		case 'p':
+			return scale * 1e-12;
+		case 'f':
+			return scale * 1e-15;
+		default:
+			return scale * 1e-9;
+	}
+}
+
+
+static void Capture_Change(const char *id, bool value) {
+	for (int32_t r = 0; r < CaptureNumRoles; r++) {
+		int32_t i = cfg.roles[r].index;
+		if ((i < 0) || strcmp(cfg.signals[i].id, id))
+			continue;
+		bool v = value ^ cfg.roles[r].invert;
+		if (v != cfg.values[r])
+			Capture_Edge(r, v);
+	}
+}
+
+
+/* Charge the interval up to t to the state that held over it.
+ * */
+static void Capture_Advance(double t) {
+	if (t <= cfg.now)
+		return;
+	EnergyState_t state;
+	if (cfg.values[CaptureRun])
+		state = EnergyRun;
+	else if (cfg.roles[CaptureStop].index >= 0)
+		state = cfg.values[CaptureStop] ? EnergyStop : EnergySleep;
+	else
+		state = cfg.values[CaptureTx] ? EnergySleep : EnergyStop;
+	double before = cfg.meter.charge;
+	Energy_Add(&cfg.meter, &cfg.model, t - cfg.now, state, cfg.sysclk, cfg.values[CaptureTx], cfg.values[CaptureMod], false); // no EEPROM signal
+	if (cfg.numPresses) {
+		CapturePress_t *p = &cfg.presses[cfg.numPresses - 1];
+		p->charge += cfg.meter.charge - before;
+		if (state == EnergyRun)
+			p->run += t - cfg.now;
+	}
+	cfg.now = t;
+}
+
+
+/* A press starts on the first rising edge of a button after it has been
+ * released for the gap; bounces are part of the same press.  Without button
+ * signals, a press starts on a wake after the gap idle, other than the wake
+ * from reset.  The firmware idles between the repeats of a held button, so
+ * presses closer together than the gap can then not be told apart.
+ * */
+static void Capture_Edge(int32_t role, bool value) {
+	bool buttons = false;
+	for (int32_t r = CaptureBtn0; r < CaptureNumRoles; r++)
+		buttons |= cfg.roles[r].index >= 0;
+	if ((role == CaptureRun) && value)
+		cfg.wakes++;
+	bool reset = cfg.wakes == 1;
+	bool trigger = buttons ? (role >= CaptureBtn0) : ((role == CaptureRun) && !reset);
+	if (trigger && value && ((cfg.now - cfg.lastLow[role]) >= cfg.gap) && (cfg.numPresses < CAPTURE_MAX_PRESSES)) {
+		if (buttons || !cfg.values[CaptureTx]) {
+			Capture_Close();
+			cfg.presses[cfg.numPresses++] = (CapturePress_t){ cfg.now, CAPTURE_NEVER, CAPTURE_NEVER, 0, 0 };
+		}
+	}
+	if ((role == CaptureMod) && cfg.numPresses) {
+		CapturePress_t *p = &cfg.presses[cfg.numPresses - 1];
+		if (p->firstMod == CAPTURE_NEVER)
+			p->firstMod = cfg.now;
+		p->lastMod = cfg.now;
+	}
+	if (!value && !((role == CaptureRun) && reset))
+		cfg.lastLow[role] = cfg.now;
+	else if (!buttons && (role == CaptureTx))
+		cfg.lastLow[CaptureRun] = cfg.now; // transmitting (in SLEEP) is not idle
+	cfg.values[role] = value;
+}
+
+
+// convert the charge of the last press to charge above idle
+static void Capture_Close(void) {
+	if (!cfg.numPresses)
+		return;
+	CapturePress_t *p = &cfg.presses[cfg.numPresses - 1];
+	p->charge = Energy_Excess(&cfg.model, p->charge, cfg.now - p->start);
+}
+
+
+static void Capture_Report(FILE *f) {
+	double excess = 0;
+	fprintf(f, "press  start_ms  latency_us  on_air_ms  run_us  charge_uC\n");
+	for (int32_t i = 0; i < cfg.numPresses; i++) {
+		CapturePress_t *p = &cfg.presses[i];
+		excess += p->charge / cfg.numPresses;
+		fprintf(f, "%5d  %8.3f  ", i, p->start * 1e3);
+		if (p->firstMod == CAPTURE_NEVER)
+			fprintf(f, "%10s  %9s  ", "-", "-");
+		else
+			fprintf(f, "%10.1f  %9.3f  ", (p->firstMod - p->start) * 1e6, (p->lastMod - p->firstMod) * 1e3);
+		fprintf(f, "%6.0f  %9.4f\n", p->run * 1e6, p->charge);
+	}
+	fprintf(f, "total: %.3f ms, %.4f uC\n", cfg.now * 1e3, cfg.meter.charge);
+	fprintf(f, "time: %.1f ms RUN, %.1f ms SLEEP, %.1f ms STOP, %.1f ms transmitting, %.1f ms IRED on\n",
+		cfg.meter.time[EnergyRun] * 1e3, cfg.meter.time[EnergySleep] * 1e3, cfg.meter.time[EnergyStop] * 1e3,
+		cfg.meter.tx * 1e3, cfg.meter.ired * 1e3);
+	if (cfg.numPresses)
+		Energy_Project(f, &cfg.model, excess);
+}
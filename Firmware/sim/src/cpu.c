@@ -0,0 +1,345 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<signal.h>
+#include	<string.h>
+#include	<ucontext.h>
+#include	"sim.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		CPU_TF								((greg_t)0x100)			// x86 EFLAGS trap flag
+#define		CPU_RED_ZONE					(128)								// x86-64 SysV ABI
+#define		CPU_PF_WRITE					((greg_t)0x2)				// page fault error code: write access
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+typedef void (*Handler_t)(void);
+
+/* The firmware runs natively, single-stepped with the x86 trap flag.  Each
+ * step that lands in firmware code counts as one CPU cycle of simulated time,
+ * and is a point at which a pending interrupt can be taken.  Peripheral
+ * registers live in pages with no access rights: each access faults, the
+ * peripheral model is consulted, and the access completes on the next step.
+ * */
+typedef struct {
+	uint32_t enabled;
+	uint32_t pending;
+	uint32_t asserted;
+	bool primask;
+	bool event;
+	bool handler;
+	bool asleep;
+	bool stopped;
+	bool access;
+	bool write;
+	uintptr_t addr;
+	uint32_t old;
+	uint64_t instructions;
+} CpuState_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static void Cpu_Fault(int sig, siginfo_t *si, void *ctx);
+static void Cpu_Trap(int sig, siginfo_t *si, void *ctx);
+static void Cpu_Trace(bool on);
+static uint32_t Cpu_Enabled(void);
+static Handler_t Cpu_Vector(int32_t irq);
+static void Cpu_Sleep(bool wfe);
+static void Cpu_Dispatch(void);
+
+void Cpu_Entry(void); // entry.S
+void Cpu_Exception(void);
+
+// firmware interrupt handlers; the startup file's weak defaults are not linked
+void SysTick_Handler(void) __attribute__((weak));
+void EXTI0_1_IRQHandler(void) __attribute__((weak));
+void EXTI2_3_IRQHandler(void) __attribute__((weak));
+void EXTI4_15_IRQHandler(void) __attribute__((weak));
+void DMA1_Channel2_3_IRQHandler(void) __attribute__((weak));
+void LPTIM1_IRQHandler(void) __attribute__((weak));
+void TIM2_IRQHandler(void) __attribute__((weak));
+void TIM21_IRQHandler(void) __attribute__((weak));
+
+extern const uint8_t __start_fwtext[];
+extern const uint8_t __stop_fwtext[];
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static CpuState_t cpu = { 0 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+void Cpu_Start(void (*entry)(void)) {
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO;
+	sa.sa_sigaction = Cpu_Fault;
+	sigaction(SIGSEGV, &sa, 0);
+	sa.sa_sigaction = Cpu_Trap;
+	sigaction(SIGTRAP, &sa, 0);
+	Cpu_Trace(true);
+	entry();
+	Cpu_Trace(false);
+	fprintf(stderr, "sim: firmware returned from main()\n");
+	Sim_Finish(2);
+}
+
+
+/* Latch interrupt requests after each simulated event.  Peripheral requests
+ * are levels; the NVIC pends on each rising edge, and again on exit from the
+ * handler if the level is still asserted.
+ * */
+void Cpu_Update(void) {
+	uint32_t asserted = Periph_IRQs(cpu.stopped);
+	uint32_t rising = asserted & ~cpu.asserted;
+	if ((rising & ~cpu.pending) && (SIM_REG(SCB->SCR) & SCB_SCR_SEVONPEND_Msk))
+		cpu.event = true;
+	cpu.pending |= rising;
+	cpu.asserted = asserted;
+}
+
+
+void Cpu_Event(void) {
+	cpu.event = true;
+}
+
+
+void Cpu_Pend(int32_t irq) {
+	if ((SIM_REG(SCB->SCR) & SCB_SCR_SEVONPEND_Msk) && !(cpu.pending & (1u << irq)))
+		cpu.event = true;
+	cpu.pending |= (1u << irq);
+}
+
+
+uint32_t Cpu_NvicRead(uintptr_t addr) {
+	if ((addr == (uintptr_t)&NVIC->ISER[0]) || (addr == (uintptr_t)&NVIC->ICER[0]))
+		return cpu.enabled;
+	if ((addr == (uintptr_t)&NVIC->ISPR[0]) || (addr == (uintptr_t)&NVIC->ICPR[0]))
+		return cpu.pending & ~(1u << SIM_IRQ_SYSTICK);
+	return *Sim_Reg(addr);
+}
+
+
+void Cpu_NvicWrite(uintptr_t addr, uint32_t val) {
+	if (addr == (uintptr_t)&NVIC->ISER[0])
+		cpu.enabled |= val;
+	else if (addr == (uintptr_t)&NVIC->ICER[0])
+		cpu.enabled &= ~val;
+	else if (addr == (uintptr_t)&NVIC->ISPR[0])
+		cpu.pending |= val;
+	else if (addr == (uintptr_t)&NVIC->ICPR[0])
+		cpu.pending &= ~val;
+}
+
+
+bool Cpu_Asleep(void) {
+	return cpu.asleep;
+}
+
+
+bool Cpu_Stopped(void) {
+	return cpu.stopped;
+}
+
+
+uint64_t Cpu_Instructions(void) {
+	return cpu.instructions;
+}
+
+
+void Cpu_SEV(void) {
+	cpu.event = true;
+}
+
+
+void Cpu_WFE(void) {
+	Cpu_Trace(false);
+	if (cpu.event)
+		cpu.event = false;
+	else
+		Cpu_Sleep(true);
+	Cpu_Dispatch();
+	Cpu_Trace(true);
+}
+
+
+void Cpu_WFI(void) {
+	Cpu_Trace(false);
+	Cpu_Sleep(false);
+	Cpu_Dispatch();
+	Cpu_Trace(true);
+}
+
+
+void Cpu_SetPRIMASK(uint32_t val) {
+	cpu.primask = val & 1; // a pending interrupt is taken at the next firmware instruction
+}
+
+
+uint32_t Cpu_GetPRIMASK(void) {
+	return cpu.primask;
+}
+
+
+/* Called from Cpu_Entry, on the firmware's stack, when an interrupt preempts
+ * thread-mode code.
+ * */
+void Cpu_Exception(void) {
+	Cpu_Dispatch();
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static void Cpu_Fault(int sig, siginfo_t *si, void *ctx) {
+	ucontext_t *uc = ctx;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+	if (!Sim_Mapped(addr) || cpu.access) {
+		// a genuine fault: let it happen
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+	cpu.addr = addr & ~(uintptr_t)3;
+	cpu.write = (uc->uc_mcontext.gregs[REG_ERR] & CPU_PF_WRITE) != 0;
+	if (!cpu.write)
+		Periph_Read(cpu.addr);
+	cpu.old = *Sim_Reg(cpu.addr);
+	cpu.access = true;
+	Sim_Protect(cpu.addr, true);
+	uc->uc_mcontext.gregs[REG_EFL] |= CPU_TF;
+}
+
+
+static void Cpu_Trap(int sig, siginfo_t *si, void *ctx) {
+	ucontext_t *uc = ctx;
+	greg_t *r = uc->uc_mcontext.gregs;
+	if (cpu.access) {
+		uint32_t val = *Sim_Reg(cpu.addr);
+		Sim_Protect(cpu.addr, false);
+		cpu.access = false;
+		// a read-modify-write instruction reports only its read
+		if (cpu.write || (val != cpu.old))
+			Periph_Write(cpu.addr, cpu.old);
+	}
+	uintptr_t pc = (uintptr_t)r[REG_RIP];
+	if ((pc < (uintptr_t)__start_fwtext) || (pc >= (uintptr_t)__stop_fwtext))
+		return;
+	cpu.instructions++;
+	Sim_Cycle();
+	if (!cpu.handler && !cpu.primask && (cpu.pending & Cpu_Enabled())) {
+		// exception entry: push the return address below the red zone
+		greg_t sp = r[REG_RSP] - CPU_RED_ZONE - 8;
+		*(greg_t *)sp = r[REG_RIP];
+		r[REG_RSP] = sp;
+		r[REG_RIP] = (greg_t)Cpu_Entry;
+		cpu.handler = true;
+	}
+}
+
+
+static void Cpu_Trace(bool on) {
+	// the simulator itself must not be single-stepped; it is built without a red zone
+	if (on)
+		__asm volatile("pushfq; orq $0x100, (%%rsp); popfq" ::: "memory", "cc");
+	else
+		__asm volatile("pushfq; andq $~0x100, (%%rsp); popfq" ::: "memory", "cc");
+}
+
+
+static uint32_t Cpu_Enabled(void) {
+	uint32_t enabled = cpu.enabled & ~(1u << SIM_IRQ_SYSTICK);
+	if (SIM_REG(SysTick->CTRL) & SysTick_CTRL_TICKINT_Msk)
+		enabled |= (1u << SIM_IRQ_SYSTICK);
+	return enabled;
+}
+
+
+static Handler_t Cpu_Vector(int32_t irq) {
+	switch (irq) {
+		case SIM_IRQ_SYSTICK:
+			return SysTick_Handler;
+		case EXTI0_1_IRQn:
+			return EXTI0_1_IRQHandler;
+		case EXTI2_3_IRQn:
+			return EXTI2_3_IRQHandler;
+		case EXTI4_15_IRQn:
+			return EXTI4_15_IRQHandler;
+		case DMA1_Channel2_3_IRQn:
+			return DMA1_Channel2_3_IRQHandler;
+		case LPTIM1_IRQn:
+			return LPTIM1_IRQHandler;
+		case TIM2_IRQn:
+			return TIM2_IRQHandler;
+		case TIM21_IRQn:
+			return TIM21_IRQHandler;
+		default:
+			return 0;
+	}
+}
+
+
+/* SLEEP, or STOP if SLEEPDEEP is set, until an event (WFE only) or an
+ * enabled interrupt.
+ * */
+static void Cpu_Sleep(bool wfe) {
+	cpu.stopped = (SIM_REG(SCB->SCR) & SCB_SCR_SLEEPDEEP_Msk) != 0;
+	cpu.asleep = true;
+	Trace_Update();
+	while (!(wfe && cpu.event) && !(cpu.pending & Cpu_Enabled()))
+		Sim_Step(cpu.stopped);
+	if (wfe)
+		cpu.event = false;
+	if (cpu.stopped) {
+		Sim_Run(Sim_Now() + SIM_STOP_WAKEUP, true);
+		cpu.stopped = false;
+	}
+	cpu.asleep = false;
+	Trace_Update();
+}
+
+
+/* Take every pending, enabled interrupt, at equal priority (lowest number
+ * first) and without nesting.  With SLEEPONEXIT set, the CPU sleeps on
+ * return to thread mode, and never actually returns.
+ * */
+static void Cpu_Dispatch(void) {
+	uint32_t ready;
+	bool taken = false;
+	while (true) {
+		while (!cpu.primask && ((ready = (cpu.pending & Cpu_Enabled())) != 0)) {
+			int32_t irq = __builtin_ctz(ready);
+			Handler_t fn = Cpu_Vector(irq);
+			cpu.pending &= ~(1u << irq);
+			cpu.handler = true;
+			if (fn) {
+				Cpu_Trace(true);
+				fn();
+				Cpu_Trace(false);
+			}
+			else
+				fprintf(stderr, "sim: no handler for IRQ %d\n", irq);
+			cpu.handler = false;
+			cpu.pending |= Periph_IRQs(false) & (1u << irq);
+			taken = true;
+		}
+		if (!taken || !(SIM_REG(SCB->SCR) & SCB_SCR_SLEEPONEXIT_Msk))
+			break;
+		Cpu_Sleep(false);
+	}
+	cpu.handler = false;
+}
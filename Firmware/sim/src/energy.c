@@ -0,0 +1,125 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+#include	"energy.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		ENERGY_NUM_MSI_RANGES	(7)
+#define		ENERGY_MSI_RANGE_0		(65536u)			// Hz
+#define		ENERGY_STOP						(0.45)				// uA, STOP with Flash and VREFINT off
+#define		ENERGY_LSI						(0.35)				// uA, LSI and LPTIM1, which run in STOP
+#define		ENERGY_TX_PER_MHZ			(25.0)				// uA/MHz, TIM2, TIM21 and DMA1 while transmitting
+#define		ENERGY_PROG						(500.0)				// uA, average over a data EEPROM erase and program
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static uint32_t Energy_Range(uint32_t sysclk);
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+/* Typical supply currents (uA) at 3V and 25C, by MSI range, for the
+ * configuration set up by System_Init(): VCORE Range 3, code in Flash.  RUN
+ * is scaled to the ~70uA at 256kHz that the design is based on.  SLEEP keeps
+ * Flash powered (the IR bitstreams are read from it by DMA), and uses the
+ * low-power regulator at ranges 0 and 1 (SYS_LP_SLEEP).
+ * */
+static const double runCurrent[ENERGY_NUM_MSI_RANGES] = { 25, 40, 70, 115, 205, 385, 745 };
+static const double sleepCurrent[ENERGY_NUM_MSI_RANGES] = { 5, 7, 22, 35, 60, 110, 210 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+void Energy_Defaults(EnergyModel_t *model) {
+	model->ired = 50;
+	model->capacity = 220; // CR2032
+	model->derating = 0.8;
+	model->pressesPerDay = 20;
+}
+
+
+/* Supply current (uA) in a given state.  The CPU clock only matters while
+ * it is running (RUN) or gated (SLEEP); it is stopped in STOP.
+ * */
+double Energy_Current(const EnergyModel_t *model, EnergyState_t state, uint32_t sysclk, bool tx, bool ired, bool prog) {
+	double i = ENERGY_LSI;
+	switch (state) {
+		case EnergyRun:
+			i += runCurrent[Energy_Range(sysclk)];
+			break;
+		case EnergySleep:
+			i += sleepCurrent[Energy_Range(sysclk)];
+			break;
+		case EnergyStop:
+		default:
+			i += ENERGY_STOP;
+			break;
+	}
+	if (tx && (state != EnergyStop))
+		i += ENERGY_TX_PER_MHZ * sysclk / 1e6;
+	if (ired)
+		i += model->ired * 1000;
+	if (prog)
+		i += ENERGY_PROG;
+	return i;
+}
+
+
+void Energy_Add(EnergyMeter_t *meter, const EnergyModel_t *model, double dt, EnergyState_t state, uint32_t sysclk, bool tx, bool ired,
+	bool prog) {
+	meter->charge += Energy_Current(model, state, sysclk, tx, ired, prog) * dt;
+	meter->time[state] += dt;
+	if (tx)
+		meter->tx += dt;
+	if (ired)
+		meter->ired += dt;
+	if (prog)
+		meter->prog += dt;
+}
+
+
+/* Charge (uC) drawn over a period, above what the remote would have drawn
+ * sitting idle in STOP for the same time.
+ * */
+double Energy_Excess(const EnergyModel_t *model, double charge, double time) {
+	return charge - (Energy_Current(model, EnergyStop, 0, false, false, false) * time);
+}
+
+
+/* Average current and battery life, given the excess charge of an average
+ * press, at the model's usage rate.
+ * */
+void Energy_Project(FILE *f, const EnergyModel_t *model, double excess) {
+	double idle = Energy_Current(model, EnergyStop, 0, false, false, false);
+	double daily = (model->pressesPerDay * excess) + (idle * ENERGY_S_PER_DAY); // uC
+	double life = (model->capacity * model->derating * ENERGY_UC_PER_MAH) / daily; // days
+	fprintf(f, "projection: %.2f uC/press above %.2f uA idle, %.0f presses/day: %.2f uA average, %.1f years on %.0f mAh\n",
+		excess, idle, model->pressesPerDay, daily / ENERGY_S_PER_DAY, life / 365.25, model->capacity);
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+// the nearest range, as the MSI may be off its nominal frequency
+static uint32_t Energy_Range(uint32_t sysclk) {
+	uint32_t range = 0;
+	while ((range < (ENERGY_NUM_MSI_RANGES - 1)) && (((ENERGY_MSI_RANGE_0 << range) * 3 / 2) < sysclk))
+		range++;
+	return range;
+}
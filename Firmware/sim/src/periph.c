@@ -0,0 +1,735 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stddef.h>
+#include	"sim.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		PERIPH_LPTIM_SYNC			(2)				// LSI cycles for a CMP or ARR write to reach the counter domain
+#define		PERIPH_DMA_CH2_SHIFT	(4)				// DMA ISR/IFCR bit position of channel 2
+#define		PERIPH_DMA_TIM2_UP		(8)				// CSELR C2S request mapping
+#define		PERIPH_TIM21_TI1_LSI	(5)				// TIM21_OR TI1_RMP: channel 1 input from LSI
+#define		PERIPH_MSI_TRIM_STEP	(0.004)		// assumed frequency change per step of MSITRIM, signed
+#define		PERIPH_PEKEY1					(0x89abcdef)
+#define		PERIPH_PEKEY2					(0x02030405)
+
+// register of peripheral p, in the simulator's alias of the register space
+#define		ALIAS(p)							((__typeof__(p))Sim_Reg((uintptr_t)(p)))
+#define		IS_REG(addr, r)				((addr) == (uintptr_t)&(r))
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+/* General purpose timer (TIM2, TIM21): upcounting, with the preload
+ * registers in the register space and their shadows (active values) here.
+ * */
+typedef struct {
+	TIM_TypeDef *regs;
+	TIM_TypeDef *alias;
+	uint16_t prescaler;
+	uint16_t psc;
+	uint16_t arr;
+	uint16_t ccr[4];
+	bool ref[4];
+	uint8_t burst;			// DMA burst index, into DCR.DBL
+	bool request;				// update DMA request
+} PeriphTimer_t;
+
+typedef struct {
+	uint8_t port;
+	uint8_t pin;
+	uint8_t af;
+	PeriphTimer_t *tim;
+	uint8_t ch;
+} PeriphAltFunc_t;
+
+typedef struct {
+	uint8_t port;
+	uint8_t pin;
+} PeriphPin_t;
+
+typedef struct {
+	uint32_t lsi;
+	double msi; // actual MSI frequency, relative to nominal, before trimming
+	uint64_t lsiReady;
+	bool pressed[SIM_NUM_BUTTONS];
+	uint16_t extiInputs;
+	// DMA1 channel 2
+	uint32_t dmaMem;
+	uint32_t dmaReload;
+	// LPTIM1
+	uint32_t lptimPrescaler;
+	bool lptimRunning;
+	int32_t cmpSync;
+	int32_t arrSync;
+	// TIM21 input capture of LSI
+	uint32_t capturePrescaler;
+	// NVM interface: data EEPROM
+	int32_t pekeys; // PEKEYR keys written in sequence
+	uint64_t progEnd;
+	// aliases
+	GPIO_TypeDef *gpio[2];
+	RCC_TypeDef *rcc;
+	EXTI_TypeDef *exti;
+	SYSCFG_TypeDef *syscfg;
+	LPTIM_TypeDef *lptim;
+	DMA_TypeDef *dma;
+	DMA_Channel_TypeDef *ch2;
+	DMA_Request_TypeDef *cselr;
+	SysTick_Type *systick;
+	FLASH_TypeDef *flash;
+} PeriphConfig_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static void Periph_TimerWrite(PeriphTimer_t *t, uintptr_t offset, uint32_t old);
+static void Periph_TimerClock(PeriphTimer_t *t, bool gate);
+static void Periph_TimerUpdate(PeriphTimer_t *t);
+static void Periph_TimerCompare(PeriphTimer_t *t);
+static bool Periph_TimerOutput(const PeriphTimer_t *t, uint8_t ch);
+static bool Periph_TimerTRGO(const PeriphTimer_t *t);
+static void Periph_DMABurst(void);
+static void Periph_DMAWrite(uintptr_t addr, uint32_t old);
+static void Periph_LPTIMWrite(uintptr_t addr, uint32_t old);
+static void Periph_NVMWrite(uintptr_t addr, uint32_t old);
+static void Periph_NVMUpdate(void);
+static void Periph_TimerCapture(PeriphTimer_t *t);
+static void Periph_GPIOWrite(int32_t port, uintptr_t addr, uint32_t old);
+static uint32_t Periph_InputData(int32_t port);
+static void Periph_EXTIUpdate(bool edges);
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static PeriphTimer_t tim2 = { TIM2 };
+static PeriphTimer_t tim21 = { TIM21 };
+
+static const PeriphAltFunc_t altFuncs[] = {
+	{ 0, 0, 2, &tim2, 0 },		// PA0 AF2: TIM2_CH1
+	{ 0, 3, 0, &tim21, 1 },		// PA3 AF0: TIM21_CH2
+	{ 0, 11, 5, &tim21, 1 },	// PA11 AF5: TIM21_CH2
+};
+
+// buttons, or key matrix rows; and key matrix columns
+#if BOARD_TYPE == BOARD_CUSTOM
+static const PeriphPin_t buttons[4] = { { 0, 9 }, { 0, 11 }, { 0, 10 }, { 0, 12 } };
+static const PeriphPin_t columns[8] = { { 0, 4 }, { 0, 5 }, { 0, 6 }, { 0, 7 } };
+#else
+static const PeriphPin_t buttons[4] = { { 1, 6 }, { 0, 1 }, { 1, 4 }, { 1, 5 } };
+static const PeriphPin_t columns[8] = { { 0, 4 }, { 0, 5 }, { 0, 6 }, { 0, 7 }, { 0, 8 }, { 0, 10 }, { 0, 12 }, { 0, 15 } };
+#endif
+
+static PeriphConfig_t cfg = { 0 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+void Periph_Init(uint32_t lsi, double msiError) {
+	cfg.lsi = lsi;
+	cfg.msi = 1 + (msiError / 100);
+	cfg.lsiReady = SIM_NEVER;
+	cfg.progEnd = SIM_NEVER;
+	cfg.gpio[0] = ALIAS(GPIOA);
+	cfg.gpio[1] = ALIAS(GPIOB);
+	cfg.rcc = ALIAS(RCC);
+	cfg.exti = ALIAS(EXTI);
+	cfg.syscfg = ALIAS(SYSCFG);
+	cfg.lptim = ALIAS(LPTIM1);
+	cfg.dma = ALIAS(DMA1);
+	cfg.ch2 = ALIAS(DMA1_Channel2);
+	cfg.cselr = ALIAS(DMA1_CSELR);
+	cfg.systick = ALIAS(SysTick);
+	cfg.flash = ALIAS(FLASH);
+	tim2.alias = ALIAS(TIM2);
+	tim21.alias = ALIAS(TIM21);
+	// reset values that the firmware depends upon
+	cfg.rcc->ICSCR = (5 << 13); // MSIRANGE=5 (2.1MHz)
+	cfg.rcc->CR = (1 << 9) + (1 << 8); // MSIRDY,MSION
+	cfg.gpio[0]->MODER = 0xebffffff;
+	cfg.gpio[1]->MODER = 0xffffffff;
+	cfg.exti->IMR = 0x3f840000;
+	tim2.alias->ARR = tim2.arr = 0xffff;
+	tim21.alias->ARR = tim21.arr = 0xffff;
+	cfg.lptim->ARR = 1;
+	cfg.flash->PECR = (1 << 2) + (1 << 1) + (1 << 0); // OPTLOCK,PRGLOCK,PELOCK
+	cfg.flash->SR = (1 << 3); // READY
+	Periph_EXTIUpdate(false);
+}
+
+
+/* Called before the firmware reads a register, to bring its value up to date.
+ * */
+void Periph_Read(uintptr_t addr) {
+	if ((addr >= (uintptr_t)NVIC) && (addr < ((uintptr_t)NVIC + sizeof(NVIC_Type))))
+		*Sim_Reg(addr) = Cpu_NvicRead(addr);
+	else if (IS_REG(addr, GPIOA->IDR))
+		cfg.gpio[0]->IDR = Periph_InputData(0);
+	else if (IS_REG(addr, GPIOB->IDR))
+		cfg.gpio[1]->IDR = Periph_InputData(1);
+	else if (IS_REG(addr, TIM21->CCR1) && ((tim21.alias->CCMR1 & 3) == 1))
+		tim21.alias->SR &= ~(1 << 1); // reading a capture clears CC1IF
+}
+
+
+/* Called once the firmware has written a register; old is its prior value.
+ * */
+void Periph_Write(uintptr_t addr, uint32_t old) {
+	uint32_t *reg = Sim_Reg(addr);
+	uint32_t val = *reg;
+	if ((addr >= (uintptr_t)NVIC) && (addr < ((uintptr_t)NVIC + sizeof(NVIC_Type))))
+		Cpu_NvicWrite(addr, val);
+	else if ((addr >= (uintptr_t)TIM2) && (addr < ((uintptr_t)TIM2 + sizeof(TIM_TypeDef))))
+		Periph_TimerWrite(&tim2, addr - (uintptr_t)TIM2, old);
+	else if ((addr >= (uintptr_t)TIM21) && (addr < ((uintptr_t)TIM21 + sizeof(TIM_TypeDef))))
+		Periph_TimerWrite(&tim21, addr - (uintptr_t)TIM21, old);
+	else if ((addr >= (uintptr_t)DMA1) && (addr < ((uintptr_t)DMA1_CSELR + sizeof(DMA_Request_TypeDef))))
+		Periph_DMAWrite(addr, old);
+	else if ((addr >= (uintptr_t)LPTIM1) && (addr < ((uintptr_t)LPTIM1 + sizeof(LPTIM_TypeDef))))
+		Periph_LPTIMWrite(addr, old);
+	else if (((addr >= (uintptr_t)FLASH) && (addr < ((uintptr_t)FLASH + sizeof(FLASH_TypeDef)))) ||
+		((addr >= DATA_EEPROM_BASE) && (addr <= DATA_EEPROM_END)))
+		Periph_NVMWrite(addr, old);
+	else if ((addr >= (uintptr_t)GPIOA) && (addr < ((uintptr_t)GPIOA + sizeof(GPIO_TypeDef))))
+		Periph_GPIOWrite(0, addr, old);
+	else if ((addr >= (uintptr_t)GPIOB) && (addr < ((uintptr_t)GPIOB + sizeof(GPIO_TypeDef))))
+		Periph_GPIOWrite(1, addr, old);
+	else if (IS_REG(addr, EXTI->PR))
+		*reg = old & ~val; // rc_w1
+	else if ((addr >= (uintptr_t)SYSCFG->EXTICR) && (addr < (uintptr_t)&SYSCFG->EXTICR[4]))
+		Periph_EXTIUpdate(false);
+	else if (IS_REG(addr, RCC->CSR)) {
+		*reg = (*reg & ~(1 << 1)) | (old & (1 << 1)); // LSIRDY is read-only
+		if ((val & (1 << 0)) && !(old & (1 << 0)))
+			cfg.lsiReady = Sim_Now() + SIM_LSI_STARTUP;
+		else if (!(val & (1 << 0))) {
+			cfg.lsiReady = SIM_NEVER;
+			*reg &= ~(1 << 1);
+		}
+	}
+	else if (IS_REG(addr, SysTick->VAL)) {
+		*reg = 0;
+		cfg.systick->CTRL &= ~SysTick_CTRL_COUNTFLAG_Msk;
+	}
+}
+
+
+/* One cycle of the system clock; the CPU may be in SLEEP.  APB and AHB
+ * peripherals are clocked if enabled, and in SLEEP only if also enabled in
+ * the corresponding SMENR register.
+ * */
+void Periph_SysClk(bool sleeping) {
+	RCC_TypeDef *rcc = cfg.rcc;
+	bool tim2On = (rcc->APB1ENR & (1 << 0)) && (!sleeping || (rcc->APB1SMENR & (1 << 0)));
+	bool tim21On = (rcc->APB2ENR & (1 << 2)) && (!sleeping || (rcc->APB2SMENR & (1 << 2)));
+	bool dmaOn = (rcc->AHBENR & (1 << 0)) && (!sleeping || (rcc->AHBSMENR & (1 << 0)));
+	if (tim2On)
+		Periph_TimerClock(&tim2, true);
+	if (tim21On)
+		Periph_TimerClock(&tim21, tim2On && Periph_TimerTRGO(&tim2));
+	if (dmaOn && tim2.request)
+		Periph_DMABurst();
+	Periph_NVMUpdate();
+	// SysTick, on the processor clock
+	SysTick_Type *st = cfg.systick;
+	if (st->CTRL & SysTick_CTRL_ENABLE_Msk) {
+		if (st->VAL == 0)
+			st->VAL = st->LOAD & 0xffffff;
+		else if (--st->VAL == 0) {
+			st->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+			if (st->CTRL & SysTick_CTRL_TICKINT_Msk)
+				Cpu_Pend(SIM_IRQ_SYSTICK);
+		}
+	}
+}
+
+
+/* One cycle of LSI, which runs in STOP.  LPTIM1 counts when it is enabled,
+ * started and clocked from LSI.
+ * */
+void Periph_LSI(bool stopped) {
+	LPTIM_TypeDef *lp = cfg.lptim;
+	Periph_NVMUpdate();
+	if (Sim_Now() >= cfg.lsiReady)
+		cfg.rcc->CSR |= (1 << 1); // LSIRDY
+	if (!(cfg.rcc->CSR & (1 << 1)))
+		return;
+	if (cfg.rcc->APB2ENR & (1 << 2))
+		Periph_TimerCapture(&tim21);
+	if (!(cfg.rcc->APB1ENR & (1u << 31)) || (((cfg.rcc->CCIPR >> 18) & 3) != 1) || !(lp->CR & (1 << 0)))
+		return;
+	if ((cfg.cmpSync > 0) && (--cfg.cmpSync == 0))
+		lp->ISR |= (1 << 3); // CMPOK
+	if ((cfg.arrSync > 0) && (--cfg.arrSync == 0))
+		lp->ISR |= (1 << 4); // ARROK
+	if (!cfg.lptimRunning)
+		return;
+	if (++cfg.lptimPrescaler < (1u << ((lp->CFGR >> 9) & 7)))
+		return;
+	cfg.lptimPrescaler = 0;
+	lp->CNT = (lp->CNT >= lp->ARR) ? 0 : lp->CNT + 1;
+	if (lp->CNT == lp->ARR)
+		lp->ISR |= (1 << 1); // ARRM
+	if (lp->CNT == lp->CMP)
+		lp->ISR |= (1 << 0); // CMPM
+}
+
+
+/* The MSI frequency for the range selected, off nominal by the error given,
+ * and trimmed by MSITRIM.
+ * */
+uint32_t Periph_SysClkHz(void) {
+	int8_t trim = (int8_t)(cfg.rcc->ICSCR >> 24);
+	return (uint32_t)((65536u << ((cfg.rcc->ICSCR >> 13) & 7)) * cfg.msi * (1 + (trim * PERIPH_MSI_TRIM_STEP)));
+}
+
+
+uint32_t Periph_LSIHz(void) {
+	return cfg.lsi;
+}
+
+
+/* Interrupt request lines, by NVIC number.  In STOP, only those that can
+ * wake the CPU through EXTI are asserted.
+ * */
+uint32_t Periph_IRQs(bool stopped) {
+	uint32_t irqs = 0;
+	uint32_t pr = cfg.exti->PR & cfg.exti->IMR;
+	if (pr & 0x0003)
+		irqs |= (1 << EXTI0_1_IRQn);
+	if (pr & 0x000c)
+		irqs |= (1 << EXTI2_3_IRQn);
+	if (pr & 0xfff0)
+		irqs |= (1 << EXTI4_15_IRQn);
+	if ((cfg.lptim->ISR & cfg.lptim->IER & 0x7f) && (!stopped || (cfg.exti->IMR & (1 << 29))))
+		irqs |= (1 << LPTIM1_IRQn);
+	if (stopped)
+		return irqs;
+	uint32_t dma = (cfg.dma->ISR >> PERIPH_DMA_CH2_SHIFT) & 0xe;
+	if (dma & cfg.ch2->CCR)
+		irqs |= (1 << DMA1_Channel2_3_IRQn);
+	if (tim2.alias->SR & tim2.alias->DIER & 0x5f)
+		irqs |= (1 << TIM2_IRQn);
+	if (tim21.alias->SR & tim21.alias->DIER & 0x5f)
+		irqs |= (1 << TIM21_IRQn);
+	return irqs;
+}
+
+
+void Periph_SetButton(int32_t id, bool pressed) {
+	cfg.pressed[id] = pressed;
+	Periph_EXTIUpdate(true);
+}
+
+
+bool Periph_Button(int32_t id) {
+	return cfg.pressed[id];
+}
+
+
+/* Level of a pin, as driven by the MCU: ODR for outputs, the timer channel
+ * for alternate functions, and otherwise low.
+ * */
+bool Periph_Pin(int32_t port, int32_t pin) {
+	GPIO_TypeDef *g = cfg.gpio[port];
+	switch ((g->MODER >> (2 * pin)) & 3) {
+		case 1:
+			return (g->ODR >> pin) & 1;
+		case 2: {
+			uint32_t af = (g->AFR[pin >> 3] >> (4 * (pin & 7))) & 15;
+			for (size_t i = 0; i < sizeof(altFuncs) / sizeof(altFuncs[0]); i++) {
+				if ((altFuncs[i].port == port) && (altFuncs[i].pin == pin) && (altFuncs[i].af == af))
+					return Periph_TimerOutput(altFuncs[i].tim, altFuncs[i].ch);
+			}
+			return false;
+		}
+		default:
+			return false;
+	}
+}
+
+
+bool Periph_Programming(void) {
+	return cfg.progEnd != SIM_NEVER;
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static void Periph_TimerWrite(PeriphTimer_t *t, uintptr_t offset, uint32_t old) {
+	TIM_TypeDef *r = t->alias;
+	switch (offset) {
+		case offsetof(TIM_TypeDef, SR):
+			r->SR &= old; // rc_w0
+			break;
+		case offsetof(TIM_TypeDef, EGR):
+			if (r->EGR & (1 << 0)) { // UG
+				r->CNT = 0;
+				t->prescaler = 0;
+				Periph_TimerUpdate(t);
+				Periph_TimerCompare(t);
+			}
+			r->EGR = 0;
+			break;
+		case offsetof(TIM_TypeDef, DIER):
+			if (!(r->DIER & (1 << 8)))
+				t->request = false; // !UDE
+			break;
+		case offsetof(TIM_TypeDef, ARR):
+			if (!(r->CR1 & (1 << 7))) // !ARPE
+				t->arr = r->ARR;
+			break;
+		case offsetof(TIM_TypeDef, CCR1):
+		case offsetof(TIM_TypeDef, CCR2):
+		case offsetof(TIM_TypeDef, CCR3):
+		case offsetof(TIM_TypeDef, CCR4): {
+			uint8_t ch = (offset - offsetof(TIM_TypeDef, CCR1)) / 4;
+			uint32_t ccmr = (ch < 2) ? r->CCMR1 : r->CCMR2;
+			if (!(ccmr & (1 << (3 + 8 * (ch & 1))))) // !OCxPE
+				t->ccr[ch] = (&r->CCR1)[ch];
+			Periph_TimerCompare(t);
+			break;
+		}
+		case offsetof(TIM_TypeDef, DCR):
+			t->burst = 0;
+			break;
+		case offsetof(TIM_TypeDef, DMAR): {
+			// write through to the register selected by DBA and the burst index
+			uint32_t dcr = r->DCR;
+			uintptr_t target = 4 * ((dcr & 0x1f) + t->burst);
+			if (++t->burst > ((dcr >> 8) & 0x1f))
+				t->burst = 0;
+			uint32_t *reg = (uint32_t *)((uintptr_t)r + target);
+			uint32_t prior = *reg;
+			*reg = r->DMAR;
+			Periph_TimerWrite(t, target, prior);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+
+static void Periph_TimerClock(PeriphTimer_t *t, bool gate) {
+	TIM_TypeDef *r = t->alias;
+	if (!(r->CR1 & (1 << 0))) // CEN
+		return;
+	if (((r->SMCR & 7) == 5) && !gate) // gated slave mode
+		return;
+	if (t->prescaler < t->psc) {
+		t->prescaler++;
+		return;
+	}
+	t->prescaler = 0;
+	if (r->CNT >= t->arr) {
+		r->CNT = 0;
+		if (!(r->CR1 & (1 << 1))) // !UDIS
+			Periph_TimerUpdate(t);
+	}
+	else
+		r->CNT++;
+	Periph_TimerCompare(t);
+}
+
+
+static void Periph_TimerUpdate(PeriphTimer_t *t) {
+	TIM_TypeDef *r = t->alias;
+	t->psc = r->PSC;
+	t->arr = r->ARR;
+	for (uint8_t ch = 0; ch < 4; ch++)
+		t->ccr[ch] = (&r->CCR1)[ch];
+	r->SR |= (1 << 0); // UIF
+	if (r->DIER & (1 << 8)) // UDE
+		t->request = true;
+}
+
+
+static void Periph_TimerCompare(PeriphTimer_t *t) {
+	TIM_TypeDef *r = t->alias;
+	for (uint8_t ch = 0; ch < 4; ch++) {
+		uint32_t ccmr = (ch < 2) ? r->CCMR1 : r->CCMR2;
+		uint32_t mode = (ccmr >> (4 + 8 * (ch & 1))) & 7;
+		switch (mode) {
+			case 4:
+				t->ref[ch] = false;
+				break;
+			case 5:
+				t->ref[ch] = true;
+				break;
+			case 6:
+				t->ref[ch] = r->CNT < t->ccr[ch]; // PWM1
+				break;
+			case 7:
+				t->ref[ch] = r->CNT >= t->ccr[ch]; // PWM2
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+
+/* One LSI cycle at TIM21's channel 1, when it is remapped to LSI and set up
+ * for input capture: CCR1 captures the counter on every IC1PSC'th cycle.
+ * */
+static void Periph_TimerCapture(PeriphTimer_t *t) {
+	TIM_TypeDef *r = t->alias;
+	if ((((r->OR >> 2) & 7) != PERIPH_TIM21_TI1_LSI) || ((r->CCMR1 & 3) != 1) || !(r->CCER & (1 << 0))) { // TI1_RMP,CC1S=TI1,CC1E
+		cfg.capturePrescaler = 0;
+		return;
+	}
+	if (++cfg.capturePrescaler < (1u << ((r->CCMR1 >> 2) & 3))) // IC1PSC
+		return;
+	cfg.capturePrescaler = 0;
+	r->CCR1 = r->CNT;
+	if (r->SR & (1 << 1))
+		r->SR |= (1 << 9); // CC1OF
+	r->SR |= (1 << 1); // CC1IF
+}
+
+
+static bool Periph_TimerOutput(const PeriphTimer_t *t, uint8_t ch) {
+	uint32_t ccer = t->alias->CCER >> (4 * ch);
+	if (!(ccer & (1 << 0))) // !CCxE
+		return false;
+	return t->ref[ch] ^ ((ccer >> 1) & 1); // CCxP
+}
+
+
+static bool Periph_TimerTRGO(const PeriphTimer_t *t) {
+	uint32_t mms = (t->alias->CR2 >> 4) & 7;
+	if (mms == 1)
+		return t->alias->CR1 & (1 << 0); // enable
+	if (mms >= 4)
+		return t->ref[mms - 4]; // OCxREF
+	return false;
+}
+
+
+/* DMA1 channel 2, serving the TIM2 update request: one burst of DCR.DBL+1
+ * transfers, memory to peripheral, completed within the cycle.
+ * */
+static void Periph_DMABurst(void) {
+	DMA_Channel_TypeDef *ch = cfg.ch2;
+	tim2.request = false;
+	if (!(ch->CCR & (1 << 0)) || (((cfg.cselr->CSELR >> 4) & 15) != PERIPH_DMA_TIM2_UP))
+		return;
+	if (!(ch->CCR & (1 << 4)) || (ch->CPAR != (uint32_t)(uintptr_t)&TIM2->DMAR)) {
+		fprintf(stderr, "sim: unsupported DMA1_Channel2 configuration\n");
+		Sim_Finish(2);
+	}
+	uint32_t msize = 1u << ((ch->CCR >> 10) & 3);
+	uint32_t transfers = ((tim2.alias->DCR >> 8) & 0x1f) + 1;
+	while (transfers-- && ch->CNDTR) {
+		uint32_t val;
+		const void *src = (const void *)(uintptr_t)cfg.dmaMem;
+		if (msize == 1)
+			val = *(const uint8_t *)src;
+		else if (msize == 2)
+			val = *(const uint16_t *)src;
+		else
+			val = *(const uint32_t *)src;
+		uint32_t prior = tim2.alias->DMAR;
+		tim2.alias->DMAR = val;
+		Periph_TimerWrite(&tim2, offsetof(TIM_TypeDef, DMAR), prior);
+		if (ch->CCR & (1 << 7)) // MINC
+			cfg.dmaMem += msize;
+		ch->CNDTR--;
+		uint32_t flags = 0;
+		if (ch->CNDTR == (cfg.dmaReload / 2))
+			flags |= (1 << 2); // HTIF
+		if (ch->CNDTR == 0) {
+			flags |= (1 << 1); // TCIF
+			if (ch->CCR & (1 << 5)) { // CIRC
+				ch->CNDTR = cfg.dmaReload;
+				cfg.dmaMem = ch->CMAR;
+			}
+		}
+		if (flags)
+			cfg.dma->ISR |= (flags + (1 << 0)) << PERIPH_DMA_CH2_SHIFT;
+	}
+}
+
+
+static void Periph_DMAWrite(uintptr_t addr, uint32_t old) {
+	DMA_Channel_TypeDef *ch = cfg.ch2;
+	uint32_t *reg = Sim_Reg(addr);
+	if (IS_REG(addr, DMA1->ISR))
+		*reg = old; // read-only
+	else if (IS_REG(addr, DMA1->IFCR)) {
+		uint32_t clear = *reg;
+		for (int32_t c = 0; c < 7; c++) {
+			if (clear & (1u << (4 * c)))
+				clear |= (15u << (4 * c)); // CGIFx clears all of the channel's flags
+		}
+		cfg.dma->ISR &= ~clear;
+		*reg = 0;
+	}
+	else if (IS_REG(addr, DMA1_Channel2->CNDTR)) {
+		if (ch->CCR & (1 << 0))
+			*reg = old; // writes are ignored while enabled
+	}
+	else if (IS_REG(addr, DMA1_Channel2->CCR)) {
+		if ((ch->CCR & (1 << 0)) && !(old & (1 << 0))) {
+			cfg.dmaReload = ch->CNDTR;
+			cfg.dmaMem = ch->CMAR;
+		}
+	}
+}
+
+
+static void Periph_LPTIMWrite(uintptr_t addr, uint32_t old) {
+	LPTIM_TypeDef *lp = cfg.lptim;
+	uint32_t *reg = Sim_Reg(addr);
+	if (IS_REG(addr, LPTIM1->ISR))
+		*reg = old; // read-only
+	else if (IS_REG(addr, LPTIM1->ICR)) {
+		lp->ISR &= ~*reg;
+		*reg = 0;
+	}
+	else if (IS_REG(addr, LPTIM1->CR)) {
+		if (!(lp->CR & (1 << 0))) {
+			// disabling resets the counter
+			cfg.lptimRunning = false;
+			cfg.lptimPrescaler = 0;
+			lp->CNT = 0;
+		}
+		else if (lp->CR & (1 << 2)) // CNTSTRT
+			cfg.lptimRunning = true;
+		lp->CR &= (1 << 0); // start bits read as zero
+	}
+	else if (IS_REG(addr, LPTIM1->CMP))
+		cfg.cmpSync = PERIPH_LPTIM_SYNC;
+	else if (IS_REG(addr, LPTIM1->ARR))
+		cfg.arrSync = PERIPH_LPTIM_SYNC;
+	else if (IS_REG(addr, LPTIM1->CNT))
+		*reg = old; // read-only
+}
+
+
+/* The NVM interface, for data EEPROM only.  PECR is unlocked by the two keys
+ * in sequence, and each word written to data EEPROM while it is unlocked is
+ * erased and programmed in a fixed time, with BSY set.  A write while it is
+ * locked is discarded, and sets WRPERR.
+ * */
+static void Periph_NVMWrite(uintptr_t addr, uint32_t old) {
+	FLASH_TypeDef *f = cfg.flash;
+	uint32_t *reg = Sim_Reg(addr);
+	if (addr <= DATA_EEPROM_END) {
+		if ((f->PECR & (1 << 0)) || (f->SR & (1 << 0))) { // PELOCK, or BSY
+			*reg = old;
+			f->SR |= (1 << 8); // WRPERR
+			return;
+		}
+		f->SR = (f->SR & ~(1 << 3)) | (1 << 0); // !READY,BSY
+		cfg.progEnd = Sim_Now() + SIM_EEPROM_PROG;
+	}
+	else if (IS_REG(addr, FLASH->PEKEYR)) {
+		if ((cfg.pekeys == 1) && (*reg == PERIPH_PEKEY2)) {
+			f->PECR &= ~(1 << 0); // PELOCK
+			cfg.pekeys = 0;
+		}
+		else
+			cfg.pekeys = (*reg == PERIPH_PEKEY1) ? 1 : 0;
+		*reg = 0;
+	}
+	else if (IS_REG(addr, FLASH->PECR)) {
+		if (old & (1 << 0))
+			*reg = old; // locked; only the keys clear PELOCK
+	}
+	else if (IS_REG(addr, FLASH->SR))
+		*reg = old & ~(*reg & ~((1 << 3) + (1 << 0))); // rc_w1, but for READY and BSY
+}
+
+
+// complete data EEPROM programming
+static void Periph_NVMUpdate(void) {
+	if (Sim_Now() < cfg.progEnd)
+		return;
+	cfg.progEnd = SIM_NEVER;
+	cfg.flash->SR = (cfg.flash->SR & ~(1 << 0)) | ((1 << 3) + (1 << 1)); // !BSY,READY,EOP
+}
+
+
+static void Periph_GPIOWrite(int32_t port, uintptr_t addr, uint32_t old) {
+	GPIO_TypeDef *g = cfg.gpio[port];
+	uintptr_t offset = addr - (uintptr_t)(port ? GPIOB : GPIOA);
+	if (offset == offsetof(GPIO_TypeDef, BSRR)) {
+		uint32_t bsrr = g->BSRR;
+		g->ODR = (g->ODR & ~(bsrr >> 16)) | (bsrr & 0xffff);
+		g->BSRR = 0;
+	}
+	else if (offset == offsetof(GPIO_TypeDef, BRR)) {
+		g->ODR &= ~g->BRR;
+		g->BRR = 0;
+	}
+	else if (offset == offsetof(GPIO_TypeDef, IDR))
+		g->IDR = old; // read-only
+	// output changes (e.g. key matrix columns) can make edges on other pins
+	Periph_EXTIUpdate((offset == offsetof(GPIO_TypeDef, BSRR)) || (offset == offsetof(GPIO_TypeDef, BRR)) ||
+		(offset == offsetof(GPIO_TypeDef, ODR)));
+}
+
+
+/* Inputs: the buttons (active low) and otherwise the pull resistors, or the
+ * pin's own output level.  A key matrix key connects its row (a button input)
+ * to its column, and pulls the row low while the column is driven low.
+ * */
+static uint32_t Periph_InputData(int32_t port) {
+	GPIO_TypeDef *g = cfg.gpio[port];
+	uint32_t idr = 0;
+	for (int32_t pin = 0; pin < 16; pin++) {
+		uint32_t mode = (g->MODER >> (2 * pin)) & 3;
+		bool level;
+		if ((mode == 1) || (mode == 2))
+			level = Periph_Pin(port, pin);
+		else if (mode == 3)
+			level = false; // analog: input buffer disabled
+		else
+			level = ((g->PUPDR >> (2 * pin)) & 3) == 1;
+		for (int32_t b = 0; b < SIM_NUM_BUTTONS; b++) {
+			const PeriphPin_t *row = &buttons[b % 4], *col = &columns[b / 4];
+			if ((mode == 0) && cfg.pressed[b] && (row->port == port) && (row->pin == pin) &&
+				(!BUTTON_MATRIX_COLS || ((((cfg.gpio[col->port]->MODER >> (2 * col->pin)) & 3) == 1) &&
+					!Periph_Pin(col->port, col->pin))))
+				level = false;
+		}
+		idr |= (uint32_t)level << pin;
+	}
+	return idr;
+}
+
+
+/* Edge detection on EXTI lines 0-15, which are asynchronous and work in STOP.
+ * Interrupt lines latch in PR; event lines wake the CPU from WFE.
+ * */
+static void Periph_EXTIUpdate(bool edges) {
+	EXTI_TypeDef *e = cfg.exti;
+	uint32_t idr[2] = { Periph_InputData(0), Periph_InputData(1) };
+	uint16_t inputs = 0;
+	for (int32_t line = 0; line < 16; line++) {
+		uint32_t port = (cfg.syscfg->EXTICR[line >> 2] >> (4 * (line & 3))) & 15;
+		if ((port < 2) && ((idr[port] >> line) & 1))
+			inputs |= (1 << line);
+	}
+	if (edges) {
+		uint32_t triggered = ((inputs & ~cfg.extiInputs) & e->RTSR) | ((~inputs & cfg.extiInputs) & e->FTSR);
+		triggered &= 0xffff;
+		e->PR |= triggered & e->IMR;
+		if (triggered & e->EMR)
+			Cpu_Event();
+	}
+	cfg.extiInputs = inputs;
+}
@@ -0,0 +1,346 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<getopt.h>
+#include	<sys/mman.h>
+#include	"sim.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		SIM_MAX_STIMULI				(256)
+#define		SIM_BOUNCE						(300 * SIM_PS_PER_US)	// period of each contact bounce
+#define		SIM_PAGE							((uintptr_t)0x1000)
+#define		SIM_EEPROM_SIZE				(DATA_EEPROM_END + 1 - DATA_EEPROM_BASE)
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+/* A region of the simulated address space.  The firmware sees it at its
+ * architectural address, with no access rights, so that every access traps;
+ * the simulator uses a second, unprotected mapping of the same memory.
+ * */
+typedef struct {
+	uintptr_t base;
+	size_t size;
+	uint8_t *alias;
+} SimRegion_t;
+
+typedef struct {
+	uint64_t time;
+	int32_t id;
+	bool pressed;
+	bool press; // first edge of a press, as opposed to a bounce
+} SimStimulus_t;
+
+typedef struct {
+	uint64_t now;
+	uint64_t end;
+	uint64_t nextSys;
+	uint64_t nextLSI;
+	bool stopped;
+	const char *eeprom; // data EEPROM image, loaded at reset and saved at the end
+	int32_t numStimuli;
+	int32_t stimulus;
+	SimStimulus_t stimuli[SIM_MAX_STIMULI];
+} SimConfig_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static void Sim_Map(void);
+static void Sim_EEPROM(bool save);
+static void Sim_Usage(const char *name);
+static void Sim_AddPress(int32_t id, uint64_t down, uint64_t up, int32_t bounces);
+static int Sim_CompareStimuli(const void *a, const void *b);
+static uint64_t Sim_Next(bool deep);
+static void Sim_Advance(uint64_t t, bool deep);
+
+int Firmware_Main(void);
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static SimRegion_t regions[] = {
+	{ PERIPH_BASE, 0x30000, 0 },			// APB, AHB (DMA, RCC, FLASH)
+	{ IOPPERIPH_BASE, 0x1000, 0 },		// GPIO
+	{ SCS_BASE, 0x1000, 0 },					// SysTick, NVIC, SCB
+	{ DATA_EEPROM_BASE, 0x1000, 0 },	// data EEPROM
+};
+
+static SimConfig_t sim = { 0 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+int main(int argc, char **argv) {
+	const char *vcd = 0;
+	uint32_t lsi = LSI_FREQ;
+	double msiError = 0;
+	EnergyModel_t model;
+	Energy_Defaults(&model);
+	int32_t bounces = 0;
+	int opt;
+	sim.end = 1000 * SIM_PS_PER_MS;
+	while ((opt = getopt(argc, argv, "t:p:b:l:m:o:e:n:i:c:h")) != -1) {
+		switch (opt) {
+			case 't':
+				sim.end = (uint64_t)(strtod(optarg, 0) * SIM_PS_PER_MS);
+				break;
+			case 'p': {
+				// button:down_ms[:up_ms]
+				int32_t id = 0;
+				double down = 0, up = -1;
+				if (sscanf(optarg, "%d:%lf:%lf", &id, &down, &up) < 2 || id < 0 || id >= SIM_NUM_BUTTONS) {
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				if (up < down)
+					up = down + 100;
+				Sim_AddPress(id, (uint64_t)(down * SIM_PS_PER_MS), (uint64_t)(up * SIM_PS_PER_MS), bounces);
+				break;
+			}
+			case 'b':
+				bounces = atoi(optarg);
+				break;
+			case 'l':
+				lsi = (uint32_t)atoi(optarg);
+				break;
+			case 'm':
+				msiError = strtod(optarg, 0);
+				break;
+			case 'o':
+				vcd = optarg;
+				break;
+			case 'e':
+				sim.eeprom = optarg;
+				break;
+			case 'n':
+				model.pressesPerDay = strtod(optarg, 0);
+				break;
+			case 'i':
+				model.ired = strtod(optarg, 0);
+				break;
+			case 'c':
+				model.capacity = strtod(optarg, 0);
+				break;
+			default:
+				Sim_Usage(argv[0]);
+				return 1;
+		}
+	}
+	qsort(sim.stimuli, sim.numStimuli, sizeof(SimStimulus_t), Sim_CompareStimuli);
+	Sim_Map();
+	Sim_EEPROM(false);
+	Periph_Init(lsi, msiError);
+	Trace_Open(vcd, &model);
+	sim.nextSys = SIM_PS_PER_S / Periph_SysClkHz();
+	sim.nextLSI = SIM_PS_PER_S / Periph_LSIHz();
+	Cpu_Start((void (*)(void))Firmware_Main);
+}
+
+
+uint64_t Sim_Now(void) {
+	return sim.now;
+}
+
+
+uint32_t *Sim_Reg(uintptr_t addr) {
+	for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+		if ((addr >= regions[i].base) && (addr < (regions[i].base + regions[i].size)))
+			return (uint32_t *)(regions[i].alias + ((addr - regions[i].base) & ~(uintptr_t)3));
+	}
+	fprintf(stderr, "sim: access to unmapped register 0x%08lx\n", (unsigned long)addr);
+	Sim_Finish(2);
+}
+
+
+bool Sim_Mapped(uintptr_t addr) {
+	for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+		if ((addr >= regions[i].base) && (addr < (regions[i].base + regions[i].size)))
+			return true;
+	}
+	return false;
+}
+
+
+void Sim_Protect(uintptr_t addr, bool open) {
+	mprotect((void *)(addr & ~(SIM_PAGE - 1)), SIM_PAGE, open ? (PROT_READ | PROT_WRITE) : PROT_NONE);
+}
+
+
+/* Advance to the next edge of the system clock; one CPU cycle.
+ * */
+void Sim_Cycle(void) {
+	Sim_Next(false); // resynchronizes the system clock after STOP
+	Sim_Run(sim.nextSys, false);
+}
+
+
+/* Process every event up to and including time until.  With deep set (STOP
+ * mode), the system clock domain is frozen.
+ * */
+void Sim_Run(uint64_t until, bool deep) {
+	uint64_t next;
+	while ((next = Sim_Next(deep)) <= until)
+		Sim_Advance(next, deep);
+	if (until >= sim.end)
+		Sim_Advance(sim.end, deep);
+	sim.now = until;
+}
+
+
+/* Process the next event, however far in the future.
+ * */
+void Sim_Step(bool deep) {
+	uint64_t next = Sim_Next(deep);
+	Sim_Advance((next > sim.end) ? sim.end : next, deep);
+}
+
+
+void Sim_Finish(int status) {
+	Trace_Report(stdout);
+	Trace_Finish();
+	Sim_EEPROM(true);
+	fflush(stdout);
+	exit(status);
+}
+
+
+/* Replaces the firmware's assert(), which would spin forever.
+ * */
+void assert(bool val) {
+	if (val)
+		return;
+	fprintf(stderr, "sim: firmware assertion failed at %.3f ms\n", (double)sim.now / SIM_PS_PER_MS);
+	Sim_Finish(2);
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static void Sim_Map(void) {
+	for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+		int fd = memfd_create("sim", 0);
+		if ((fd < 0) || (ftruncate(fd, regions[i].size) != 0)) {
+			perror("sim: memfd");
+			exit(1);
+		}
+		void *p = mmap((void *)regions[i].base, regions[i].size, PROT_NONE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+		regions[i].alias = mmap(0, regions[i].size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if ((p != (void *)regions[i].base) || (regions[i].alias == MAP_FAILED)) {
+			perror("sim: mmap");
+			exit(1);
+		}
+		close(fd);
+	}
+}
+
+
+/* Load or save the data EEPROM image, if any, so that a run can follow on
+ * from the last, as after a reset or a battery change.
+ * */
+static void Sim_EEPROM(bool save) {
+	FILE *f;
+	if (!sim.eeprom || !(f = fopen(sim.eeprom, save ? "wb" : "rb")))
+		return;
+	if (save)
+		fwrite(Sim_Reg(DATA_EEPROM_BASE), 1, SIM_EEPROM_SIZE, f);
+	else if (fread(Sim_Reg(DATA_EEPROM_BASE), 1, SIM_EEPROM_SIZE, f) != SIM_EEPROM_SIZE)
+		fprintf(stderr, "sim: short EEPROM image; the rest is erased\n");
+	fclose(f);
+}
+
+
+static void Sim_Usage(const char *name) {
+	EnergyModel_t model;
+	Energy_Defaults(&model);
+	fprintf(stderr,
+		"usage: %s [-t end_ms] [-b bounces] [-p button:down_ms[:up_ms]]... [-l lsi_hz] [-m msi_error_%%]\n"
+		"          [-o trace.vcd] [-e eeprom.bin] [-n presses_per_day] [-i ired_ma] [-c battery_mah]\n"
+		"  -t  simulated time (default 1000ms)\n"
+		"  -b  contact bounces on each following press and release edge (default 0)\n"
+		"  -p  press button (or key matrix key) n at down_ms, release at up_ms (default down_ms+100)\n"
+		"  -l  actual LSI frequency (default %d)\n"
+		"  -m  actual MSI frequency error, before any trimming (default 0%%)\n"
+		"  -o  write the IR, RUN and button signals to a VCD file\n"
+		"  -e  load data EEPROM from a file, if it exists (otherwise erased), and save it there at the end\n"
+		"  -n  usage, for the battery life projection (default %.0f)\n"
+		"  -i  IRED current while on (default %.0fmA)\n"
+		"  -c  battery capacity (default %.0fmAh)\n", name, LSI_FREQ, model.pressesPerDay, model.ired, model.capacity);
+}
+
+
+static void Sim_AddPress(int32_t id, uint64_t down, uint64_t up, int32_t bounces) {
+	if ((sim.numStimuli + (4 * bounces) + 2) > SIM_MAX_STIMULI)
+		return;
+	sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ down, id, true, true };
+	sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ up, id, false, false };
+	for (int32_t i = 0; i < bounces; i++) {
+		uint64_t t = (2 * i + 1) * SIM_BOUNCE;
+		sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ down + t, id, false, false };
+		sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ down + t + SIM_BOUNCE, id, true, false };
+		sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ up + t, id, true, false };
+		sim.stimuli[sim.numStimuli++] = (SimStimulus_t){ up + t + SIM_BOUNCE, id, false, false };
+	}
+}
+
+
+static int Sim_CompareStimuli(const void *a, const void *b) {
+	const SimStimulus_t *sa = a, *sb = b;
+	return (sa->time > sb->time) - (sa->time < sb->time);
+}
+
+
+static uint64_t Sim_Next(bool deep) {
+	uint64_t next = sim.nextLSI;
+	if (!deep) {
+		if (sim.stopped) {
+			// the system clock restarts on exit from STOP
+			sim.nextSys = sim.now + (SIM_PS_PER_S / Periph_SysClkHz());
+			sim.stopped = false;
+		}
+		if (sim.nextSys < next)
+			next = sim.nextSys;
+	}
+	if ((sim.stimulus < sim.numStimuli) && (sim.stimuli[sim.stimulus].time < next))
+		next = sim.stimuli[sim.stimulus].time;
+	return next;
+}
+
+
+static void Sim_Advance(uint64_t t, bool deep) {
+	sim.now = t;
+	sim.stopped |= deep;
+	while ((sim.stimulus < sim.numStimuli) && (sim.stimuli[sim.stimulus].time <= t)) {
+		SimStimulus_t *s = &sim.stimuli[sim.stimulus++];
+		if (s->press)
+			Trace_Press(s->id);
+		Periph_SetButton(s->id, s->pressed);
+	}
+	if (!deep && (sim.nextSys <= t)) {
+		Periph_SysClk(Cpu_Asleep());
+		sim.nextSys += SIM_PS_PER_S / Periph_SysClkHz();
+	}
+	if (sim.nextLSI <= t) {
+		Periph_LSI(deep);
+		sim.nextLSI += SIM_PS_PER_S / Periph_LSIHz();
+	}
+	Cpu_Update();
+	Trace_Update();
+	if (t >= sim.end)
+		Sim_Finish(0);
+}
@@ -0,0 +1,259 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	<stdio.h>
+#include	"sim.h"
+#include	"energy.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		TRACE_MAX_PRESSES			(64)
+#define		TRACE_PS_PER_TICK			(1000)		// VCD timescale: 1ns
+
+enum {
+	TraceMod = 0,
+	TraceLevel,
+	TraceRun,
+	TraceTx,
+	TraceAwake,
+	TraceStop,
+	TraceBtn0,
+	TraceNumSignals = TraceBtn0 + 4,
+};
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+typedef struct {
+	int32_t id;
+	uint64_t pressed;
+	uint64_t firstMod;		// first IR carrier edge after the press
+	uint64_t lastMod;
+	uint32_t wakes;
+	uint64_t awake;
+	double charge;				// uC, above idle
+	uint64_t instructions;
+} TracePress_t;
+
+typedef struct {
+	const char *name;
+	int8_t port;		// -1 for CPU and stimulus signals
+	int8_t pin;
+} TraceSignal_t;
+
+typedef struct {
+	FILE *vcd;
+	bool value[TraceNumSignals];
+	uint64_t lastTime;
+	uint64_t wokeAt;
+	uint32_t wakes;
+	uint64_t awake;
+	EnergyModel_t model;
+	EnergyMeter_t meter;
+	uint64_t metered;				// time up to which the meter has been run
+	uint32_t clk;
+	bool prog;							// programming data EEPROM
+	int32_t numPresses;
+	TracePress_t presses[TRACE_MAX_PRESSES];
+} TraceConfig_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+static bool Trace_Value(int32_t i);
+static void Trace_Meter(uint64_t now);
+static void Trace_Close(TracePress_t *p);
+static TracePress_t *Trace_Current(void);
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static const TraceSignal_t signals[TraceNumSignals] = {
+#if BOARD_TYPE == BOARD_CUSTOM
+	{ "ir_mod", 0, 3 }, { "ir_level", 0, 0 }, { "run", 0, 2 }, { "tx", 0, 1 },
+#else
+	{ "ir_mod", 0, 11 }, { "ir_level", 0, 0 }, { "run", 0, 9 }, { "tx", 1, 3 },
+#endif
+	{ "awake", -1, 0 }, { "stop", -1, 0 },
+	{ "btn0", -1, 0 }, { "btn1", -1, 1 }, { "btn2", -1, 2 }, { "btn3", -1, 3 },
+};
+
+static TraceConfig_t cfg = { 0 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+void Trace_Open(const char *path, const EnergyModel_t *model) {
+	cfg.model = *model;
+	cfg.clk = Periph_SysClkHz();
+	for (int32_t i = 0; i < TraceNumSignals; i++)
+		cfg.value[i] = Trace_Value(i);
+	if (!path)
+		return;
+	cfg.vcd = fopen(path, "w");
+	if (!cfg.vcd) {
+		perror("sim: VCD");
+		return;
+	}
+	fprintf(cfg.vcd, "$timescale 1ns $end\n$scope module fanirrc $end\n");
+	for (int32_t i = 0; i < TraceNumSignals; i++)
+		fprintf(cfg.vcd, "$var wire 1 %c %s $end\n", '!' + i, signals[i].name);
+	fprintf(cfg.vcd, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+	for (int32_t i = 0; i < TraceNumSignals; i++)
+		fprintf(cfg.vcd, "%d%c\n", cfg.value[i], '!' + i);
+	fprintf(cfg.vcd, "$end\n");
+}
+
+
+/* Sample every signal, after each simulated event, and record changes.  The
+ * energy meter is run up to each change of state that affects the current.
+ * */
+void Trace_Update(void) {
+	uint64_t now = Sim_Now();
+	TracePress_t *p = Trace_Current();
+	bool values[TraceNumSignals];
+	for (int32_t i = 0; i < TraceNumSignals; i++)
+		values[i] = Trace_Value(i);
+	if ((values[TraceAwake] != cfg.value[TraceAwake]) || (values[TraceStop] != cfg.value[TraceStop]) ||
+		(values[TraceTx] != cfg.value[TraceTx]) || (values[TraceMod] != cfg.value[TraceMod]) || (Periph_SysClkHz() != cfg.clk) ||
+		(Periph_Programming() != cfg.prog))
+		Trace_Meter(now);
+	for (int32_t i = 0; i < TraceNumSignals; i++) {
+		bool v = values[i];
+		if (v == cfg.value[i])
+			continue;
+		cfg.value[i] = v;
+		if (cfg.vcd) {
+			if (now != cfg.lastTime)
+				fprintf(cfg.vcd, "#%llu\n", (unsigned long long)(now / TRACE_PS_PER_TICK));
+			cfg.lastTime = now;
+			fprintf(cfg.vcd, "%d%c\n", v, '!' + i);
+		}
+		if ((i == TraceMod) && p) {
+			if (p->firstMod == SIM_NEVER)
+				p->firstMod = now;
+			p->lastMod = now;
+		}
+		else if (i == TraceAwake) {
+			if (v) {
+				cfg.wokeAt = now;
+				cfg.wakes++;
+			}
+			else
+				cfg.awake += now - cfg.wokeAt;
+		}
+	}
+}
+
+
+void Trace_Press(int32_t id) {
+	TracePress_t *p = Trace_Current();
+	Trace_Meter(Sim_Now());
+	if (p)
+		Trace_Close(p);
+	if (cfg.numPresses >= TRACE_MAX_PRESSES)
+		return;
+	p = &cfg.presses[cfg.numPresses++];
+	*p = (TracePress_t){ id, Sim_Now(), SIM_NEVER, SIM_NEVER, cfg.wakes, cfg.awake, cfg.meter.charge, Cpu_Instructions() };
+}
+
+
+/* One line per press: from the press to the first edge of the IR carrier,
+ * the time on air, then wakes, time awake, the charge drawn above idle and
+ * instructions executed until the next press (or the end of the simulation).
+ * Then the battery life that the average press implies.
+ * */
+void Trace_Report(FILE *f) {
+	double excess = 0;
+	uint64_t now = Sim_Now();
+	Trace_Meter(now);
+	if (cfg.value[TraceAwake])
+		cfg.awake += now - cfg.wokeAt;
+	cfg.value[TraceAwake] = false;
+	if (cfg.numPresses)
+		Trace_Close(Trace_Current());
+	fprintf(f, "btn  press_ms  latency_us  on_air_ms  wakes  awake_us  charge_uC  instructions\n");
+	for (int32_t i = 0; i < cfg.numPresses; i++) {
+		TracePress_t *p = &cfg.presses[i];
+		excess += p->charge / cfg.numPresses;
+		fprintf(f, "%3d  %8.3f  ", p->id, (double)p->pressed / SIM_PS_PER_MS);
+		if (p->firstMod == SIM_NEVER)
+			fprintf(f, "%10s  %9s  ", "-", "-");
+		else
+			fprintf(f, "%10.1f  %9.3f  ", (double)(p->firstMod - p->pressed) / SIM_PS_PER_US, (double)(p->lastMod - p->firstMod) / SIM_PS_PER_MS);
+		fprintf(f, "%5u  %8.1f  %9.4f  %12llu\n", p->wakes, (double)p->awake / SIM_PS_PER_US, p->charge,
+			(unsigned long long)p->instructions);
+	}
+	fprintf(f, "total: %.3f ms, %u wakes, %.1f us awake, %.4f uC, %llu instructions\n", (double)now / SIM_PS_PER_MS,
+		cfg.wakes, (double)cfg.awake / SIM_PS_PER_US, cfg.meter.charge, (unsigned long long)Cpu_Instructions());
+	fprintf(f, "time: %.1f ms RUN, %.1f ms SLEEP, %.1f ms STOP, %.1f ms transmitting, %.1f ms IRED on, %.1f ms EEPROM\n",
+		cfg.meter.time[EnergyRun] * 1e3, cfg.meter.time[EnergySleep] * 1e3, cfg.meter.time[EnergyStop] * 1e3,
+		cfg.meter.tx * 1e3, cfg.meter.ired * 1e3, cfg.meter.prog * 1e3);
+	if (cfg.numPresses)
+		Energy_Project(f, &cfg.model, excess);
+}
+
+
+void Trace_Finish(void) {
+	if (cfg.vcd) {
+		fprintf(cfg.vcd, "#%llu\n", (unsigned long long)(Sim_Now() / TRACE_PS_PER_TICK));
+		fclose(cfg.vcd);
+	}
+	cfg.vcd = 0;
+}
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static bool Trace_Value(int32_t i) {
+	if (signals[i].port >= 0)
+		return Periph_Pin(signals[i].port, signals[i].pin);
+	switch (i) {
+		case TraceAwake:
+			return !Cpu_Asleep();
+		case TraceStop:
+			return Cpu_Asleep() && Cpu_Stopped();
+		default:
+			return Periph_Button(signals[i].pin);
+	}
+}
+
+
+/* Charge the time since the last state change to the state that held over
+ * it: RUN, SLEEP or STOP, whether the IR engine was running, whether the IRED
+ * was on (the modulated output is high), and whether data EEPROM was being
+ * programmed.
+ * */
+static void Trace_Meter(uint64_t now) {
+	EnergyState_t state = cfg.value[TraceAwake] ? EnergyRun : (cfg.value[TraceStop] ? EnergyStop : EnergySleep);
+	Energy_Add(&cfg.meter, &cfg.model, (double)(now - cfg.metered) / SIM_PS_PER_S, state, cfg.clk,
+		cfg.value[TraceTx], cfg.value[TraceMod], cfg.prog);
+	cfg.metered = now;
+	cfg.clk = Periph_SysClkHz();
+	cfg.prog = Periph_Programming();
+}
+
+
+// close the measurements of a press, at the next press or the end of the simulation
+static void Trace_Close(TracePress_t *p) {
+	uint64_t now = Sim_Now();
+	p->wakes = cfg.wakes - p->wakes;
+	p->awake = cfg.awake - p->awake;
+	p->charge = Energy_Excess(&cfg.model, cfg.meter.charge - p->charge, (double)(now - p->pressed) / SIM_PS_PER_S);
+	p->instructions = Cpu_Instructions() - p->instructions;
+}
+
+
+static TracePress_t *Trace_Current(void) {
+	return cfg.numPresses ? &cfg.presses[cfg.numPresses - 1] : 0;
+}
@@ -5,7 +5,6 @@
 #include	"stm32l0xx.h"
 #include	<stdint.h>
 #include	<stdbool.h>
-#include	<stdlib.h>
 #include	"buttons.h"
 #include	"config.h"
 #include	"utils.h"
@@ -14,29 +13,36 @@
  private constants
  ===============================================*/
 
+#define		BUTTONS_MAX						(32)	// one per bit of Triggers_t
+#define		BUTTONS_LANE(i)				((ButtonLanes_t)1 << (i))
+
 /*===============================================
  private data prototypes
  ===============================================*/
 
-typedef enum {
-	ButtonIdle = 0,
-	ButtonTriggered,
-	ButtonActive,
-} ButtonState_t;
-
-typedef struct {
-	int32_t debounce;
-	int32_t repeat;
-	ButtonState_t state;
-	uint32_t timestamp;
-} ButtonStatus_t;
+typedef uint32_t ButtonLanes_t; // one bit per button
 
+/* Button state is held bit-parallel, one bit per button in each mask, and
+ * all buttons are stepped together from a single sample.  A button is idle,
+ * triggered (pressed, and waiting out the debounce period) or active
+ * (debounced, and waiting out the repeat period, if any).  Only the buttons
+ * that are waiting out a period have a deadline.  The periods, and the
+ * storage for the deadlines, are the caller's, sized and initialized at
+ * compile time.
+ * */
 typedef struct {
 	void (*initHW)(void);
-	int32_t (*readHW)(int32_t id);
+	uint32_t (*readHW)(void);
 	uint32_t (*readClk)(void);
-	int32_t numButtons;
-	ButtonStatus_t *buttons;
+	ButtonLanes_t all;
+	ButtonLanes_t repeats; // buttons with a repeat period
+	ButtonLanes_t triggered;
+	ButtonLanes_t active;
+	ButtonLanes_t pressed; // at the last service: newly pressed
+	ButtonLanes_t bounced; // and released before being debounced
+	ButtonLanes_t quiet; // idle, and released too recently for a press to be new
+	const ButtonSetup_t *setup;
+	uint32_t *deadline; // tick count at the end of each button's current period
 } ButtonsConfig_t;
 
 
@@ -44,13 +50,13 @@ typedef struct {
  private function prototypes
  ===============================================*/
 
-static bool Button_AnyActive();
+static ButtonLanes_t Buttons_Waiting(void);
 
 /*===============================================
  private global variables
  ===============================================*/
 
-static ButtonsConfig_t cfg = { 0, 0 };
+static ButtonsConfig_t cfg = { 0 };
 
 /*===============================================
  public functions
@@ -61,73 +67,105 @@ void Buttons_Init(
 	const ReadButtonHW_t read_hw,
 	const GetClock_t read_clk,
 	const int32_t numButtons,
-	const ButtonSetup_t * const buttons
+	const ButtonSetup_t * const buttons,
+	uint32_t * const deadlines
 ) {
 	assert(init_hw && read_hw && read_clk);
+	assert((numButtons <= BUTTONS_MAX) && ((numButtons <= 0) || (buttons && deadlines)));
 	cfg.initHW = init_hw;
 	cfg.readHW = read_hw;
 	cfg.readClk = read_clk;
-	cfg.numButtons = numButtons > 0 ? numButtons : 0;
-	cfg.buttons = cfg.numButtons > 0 ? calloc(cfg.numButtons, sizeof(ButtonStatus_t)) : 0;
+	cfg.all = numButtons > 0 ? ~(ButtonLanes_t)0 >> (BUTTONS_MAX - numButtons) : 0;
+	cfg.setup = buttons;
+	cfg.deadline = deadlines;
 	init_hw();
-	for (int32_t i = 0; i < cfg.numButtons; i++) {
-		cfg.buttons[i].debounce = (buttons[i].debounce + (SYSTICK_MS / 2)) / SYSTICK_MS;
-		if (cfg.buttons[i].debounce <= 0 && buttons[i].debounce > 0) cfg.buttons[i].debounce = 1;
-		cfg.buttons[i].repeat = (buttons[i].repeat + (SYSTICK_MS / 2)) / SYSTICK_MS;
-		if (cfg.buttons[i].repeat <= 0 && buttons[i].repeat > 0) cfg.buttons[i].repeat = 1;
-		cfg.buttons[i].state = ButtonIdle;
-		cfg.buttons[i].timestamp = 0;
+	for (int32_t i = 0; i < numButtons; i++) {
+		if (buttons[i].repeat > 0)
+			cfg.repeats |= BUTTONS_LANE(i);
 	}
 }
 
- bool Buttons_Service(Triggers_t *triggers) {
-	Triggers_t btrigs;
-	if (cfg.numButtons <= 0 || !cfg.buttons)
-		return false;
-	btrigs.val = 0;
-	int32_t i, bval;
+/* The buttons are sampled once, as a mask, and stepped together: released
+ * buttons go idle, buttons that have waited out their debounce or repeat
+ * period trigger, and newly pressed buttons start their debounce period.
+ * While any button is active, triggers from higher numbered buttons are
+ * suppressed, so that the lowest numbered held button has priority.
+ * */
+bool Buttons_Service(Triggers_t *triggers) {
+	ButtonLanes_t pressed, waiting, fired = 0;
+	int32_t i;
 	uint32_t t = cfg.readClk();
-	for (i = 0; i < cfg.numButtons; i++) {
-		bval = cfg.readHW(i);
-		switch (cfg.buttons[i].state) {
-			case ButtonTriggered:
-				if (!bval) {
-					cfg.buttons[i].timestamp = t;
-					cfg.buttons[i].state = ButtonIdle;
-				}
-				else if ((t - cfg.buttons[i].timestamp) >= cfg.buttons[i].debounce) {
-					cfg.buttons[i].timestamp = t;
-					cfg.buttons[i].state = ButtonActive;
-					btrigs.val |= (1 << i);
-				}
-				// implied else - no change
-				break;
-			case ButtonActive:
-				if (!bval) {
-					cfg.buttons[i].timestamp = t;
-					cfg.buttons[i].state = ButtonIdle;
-				}
-				else if ((cfg.buttons[i].repeat > 0) && ((t - cfg.buttons[i].timestamp) >= cfg.buttons[i].repeat)) {
-					cfg.buttons[i].timestamp = t;
-					btrigs.val |= (1 << i);
-				}
-				// implied else - no change
-				break;
-			case ButtonIdle:
-			default:
-				cfg.buttons[i].timestamp = t;
-				if (bval)
-					cfg.buttons[i].state = ButtonTriggered;
-				else
-					cfg.buttons[i].state = ButtonIdle;
+	if (!cfg.all)
+		return false;
+	pressed = (ButtonLanes_t)cfg.readHW() & cfg.all;
+	// released, debounced buttons stay quiet for a debounce period
+	waiting = cfg.active & ~pressed;
+	cfg.quiet |= waiting;
+	for (i = 0; waiting >> i; i++) {
+		if (waiting & BUTTONS_LANE(i))
+			cfg.deadline[i] = t + cfg.setup[i].debounce;
+	}
+	cfg.bounced = cfg.triggered & ~pressed;
+	cfg.triggered &= pressed;
+	cfg.active &= pressed;
+	// debounced, or repeating
+	waiting = Buttons_Waiting();
+	for (i = 0; waiting >> i; i++) {
+		if ((waiting & BUTTONS_LANE(i)) && ((int32_t)(t - cfg.deadline[i]) >= 0)) {
+			fired |= BUTTONS_LANE(i);
+			cfg.deadline[i] = t + cfg.setup[i].repeat;
 		}
 	}
-	for (i = 0; i < cfg.numButtons; i++) {
-		if (cfg.buttons[i].state == ButtonActive)
-			btrigs.val &= ((1 << (i + 1)) - 1);
+	cfg.active |= fired;
+	cfg.triggered &= ~fired;
+	// newly pressed
+	pressed &= ~(cfg.triggered | cfg.active);
+	cfg.triggered |= pressed;
+	for (i = 0; pressed >> i; i++) {
+		if (!(pressed & BUTTONS_LANE(i)))
+			continue;
+		if ((cfg.quiet & BUTTONS_LANE(i)) && ((int32_t)(t - cfg.deadline[i]) >= 0))
+			cfg.quiet &= ~BUTTONS_LANE(i);
+		cfg.deadline[i] = t + cfg.setup[i].debounce; // extends a quiet period through release bounce
+	}
+	if (cfg.active) {
+		fired &= ((cfg.active & -cfg.active) << 1) - 1; // at or below the lowest active button
+		pressed &= ((cfg.active & -cfg.active) << 1) - 1;
+	}
+	cfg.pressed = pressed & ~cfg.quiet;
+	triggers->val = fired;
+	return (cfg.triggered | cfg.active) != 0;
+}
+
+
+/* The earliest time at which Buttons_Service() could next emit a trigger
+ * without a change of button state, i.e. the end of a debounce or repeat
+ * period.  Returns false if there is no such deadline, in which case only a
+ * button edge can change anything.
+ * */
+bool Buttons_NextDeadline(uint32_t *deadline) {
+	ButtonLanes_t waiting = Buttons_Waiting();
+	bool any = false;
+	for (int32_t i = 0; waiting >> i; i++) {
+		if (!(waiting & BUTTONS_LANE(i)))
+			continue;
+		if (!any || ((int32_t)(cfg.deadline[i] - *deadline) < 0))
+			*deadline = cfg.deadline[i];
+		any = true;
 	}
-	*triggers = btrigs;
-	return Button_AnyActive();
+	return any;
+}
+
+
+/* The buttons that were newly pressed at the last service, before any
+ * debouncing (subject to the same priority as triggers), and those that were
+ * released before they had been debounced.  For transmitting speculatively,
+ * ahead of the trigger.  A press within a debounce period of releasing a
+ * debounced button is taken as release bounce, and is not reported.
+ * */
+void Buttons_Edges(Triggers_t *pressed, Triggers_t *bounced) {
+	pressed->val = cfg.pressed;
+	bounced->val = cfg.bounced;
 }
 
 
@@ -135,11 +173,7 @@ void Buttons_Init(
  private functions
  ===============================================*/
 
-static bool Button_AnyActive() {
-	for (int32_t i = 0; i < cfg.numButtons; i++) {
-		if (cfg.buttons[i].state != ButtonIdle)
-			return true;
-	}
-	return false;
+// buttons waiting out a debounce or repeat period
+static ButtonLanes_t Buttons_Waiting(void) {
+	return cfg.triggered | (cfg.active & cfg.repeats);
 }
-
@@ -13,6 +13,13 @@
  public constants
  ===============================================*/
 
+/* A ButtonSetup_t initializer, from debounce and repeat periods in ms.  The
+ * periods are converted to ticks at compile time, and a non-zero period is at
+ * least one tick.  A repeat period of 0 disables auto-repeat.
+ * */
+#define	BUTTONS_MS_TO_TICKS(ms)				((((ms) > 0) && (SYS_MS_TO_TICKS(ms) == 0)) ? 1 : SYS_MS_TO_TICKS(ms))
+#define	BUTTONS_SETUP(debounce, repeat)	{ BUTTONS_MS_TO_TICKS(debounce), BUTTONS_MS_TO_TICKS(repeat) }
+
 /*===============================================
  public data prototypes
  ===============================================*/
@@ -26,8 +33,11 @@ void Buttons_Init(
 	const ReadButtonHW_t read_hw,
 	const GetClock_t read_clk,
 	const int32_t numButtons,
-	const ButtonSetup_t * const buttons
+	const ButtonSetup_t * const buttons,
+	uint32_t * const deadlines
 );
 bool Buttons_Service(Triggers_t *triggers);
+bool Buttons_NextDeadline(uint32_t *deadline);
+void Buttons_Edges(Triggers_t *pressed, Triggers_t *bounced);
 
 #endif // SRC_INC_BUTTONS_H_
@@ -5,23 +5,174 @@
  user-defined public constants
  ===============================================*/
 
+// Each of these may instead be given on the compiler command line (-D).
+
+#ifndef BOARD_TYPE
 //#define	BOARD_TYPE				(BOARD_NUCLEO)
 #define	BOARD_TYPE				(BOARD_CUSTOM)
+#endif
 /* The board that is being built for.
  * Options are BOARD_NUCLEO (0) or BOARD_CUSTOM (1).
- * This is only relevant for GPIO's, in "system.c".
+ * This selects the board's pin table, in "system.c".
  * */
 
+#ifndef MSI_CLK_DIV
 #define	MSI_CLK_DIV				(16)
+#endif
 /* The clock divider to be applied to the MSI clock when the CPU is running.
  * Must be an integral power of two in the range 1-64 (2^0-2^6).
  * */
-#define	SYSTICK_MS				(10)
-/* The (approximate) number of milliseconds between systick counts (and
- * interrupts). Must be a positive integer.
- * Note that the systick timer is a 16-bit counter that is driven by the system
- * clock.  If the value of (SYSTICK_MS * SYS_CLK / 1000) > 65536 then a
- * compiler error will be raised.
+#ifndef MSI_BURST_DIV
+#define	MSI_BURST_DIV			(0)
+#endif
+/* The clock divider for a faster MSI burst on every wake from STOP, or 0 for
+ * none: the CPU then runs at MSI_CLK_DIV only until it sets the alarm, or the
+ * IR engine starts transmitting.  Must be 0, or an integral power of two in
+ * the range 1 to MSI_CLK_DIV.
+ * */
+#ifndef MSI_TX_DIV
+#define	MSI_TX_DIV				(0)
+#endif
+/* The clock divider to be applied to the MSI clock while the IR engine is
+ * transmitting (strictly, while any module votes for a state shallower than
+ * STOP), or 0 for MSI_CLK_DIV.  The carrier period is a whole number of these
+ * clock cycles, so at 32 or 64 it is only 2-4 cycles, and the carrier is up to
+ * 18% off frequency; a divider of 16 or less, with an MSI_CLK_DIV of 32 or 64,
+ * keeps the carrier accurate while everything else runs at the lowest clock.
+ * Must be 0, or an integral power of two in the range 1-64.
+ * */
+#ifndef IR_CARRIER_DUTY
+#define	IR_CARRIER_DUTY		(33)
+#endif
+/* The carrier duty cycle (percent) of each IR protocol, unless its descriptor
+ * in "irproto.c" sets its own.  The IRED draws most of the charge for a press,
+ * in proportion to this.  It is rounded to whole clock cycles at MSI_TX_DIV,
+ * and must leave the IRED on for at least one, and off for at least one.
+ * */
+#ifndef IR_CMD0_PROTOCOL
+#define	IR_CMD0_PROTOCOL	(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD0_CODE
+#define	IR_CMD0_CODE			(0x5000)	// power toggle
+#endif
+#ifndef IR_CMD1_PROTOCOL
+#define	IR_CMD1_PROTOCOL	(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD1_CODE
+#define	IR_CMD1_CODE			(0x50fa)	// speed down
+#endif
+#ifndef IR_CMD2_PROTOCOL
+#define	IR_CMD2_PROTOCOL	(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD2_CODE
+#define	IR_CMD2_CODE			(0x5054)	// speed up
+#endif
+#ifndef IR_CMD3_PROTOCOL
+#define	IR_CMD3_PROTOCOL	(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD3_CODE
+#define	IR_CMD3_CODE			(0x50a8)	// rotate toggle
+#endif
+/* The protocol and code of each of the four commands, sent by buttons (keys)
+ * 0-3.  Protocols are IR_PROTO_FAN (0), IR_PROTO_NEC (1), IR_PROTO_SIRC12 (2),
+ * IR_PROTO_RC5 (3) or IR_PROTO_RC6 (4), as described in "irproto.c".  The
+ * code is the protocol's whole data word, with its counter or toggle bit
+ * clear, in the protocol's bit order: e.g. 0xf708fb04 for NEC address 0x04,
+ * command 0x08 (sent LSB first), or 0x300c for RC5 address 0, command 12
+ * (with its two start bits, sent MSB first).  Fan commands are sent from
+ * bitstreams prebuilt in Flash; the others are encoded as they are sent.
+ * */
+#ifndef IR_PREBUILT
+#define	IR_PREBUILT				(1)
+#endif
+/* Set to 0 to encode fan commands as they are sent, as for the other
+ * protocols, rather than prebuilding their bitstreams in Flash.  This saves
+ * the tables' Flash, but the encoder then runs at the start of every
+ * transmission, adding to the press-to-IR latency.
+ * */
+#ifndef MSI_CAL_INTERVAL
+#define	MSI_CAL_INTERVAL	(0)
+#endif
+/* Seconds between calibrations of the MSI clock against LSI, or 0 for none.
+ * MSITRIM is searched at startup, and then stepped on the first wake from STOP
+ * after each interval, to keep the MSI at its nominal ratio to LSI_FREQ.  LSI
+ * varies far more between parts than the factory-trimmed MSI, so this only
+ * helps with LSI_FREQ set to the LSI frequency measured on the board.
+ * */
+#ifndef LSI_FREQ
+#define	LSI_FREQ					(37000)
+#endif
+/* The LSI frequency (Hz) that the tick, and any MSI calibration, assume: the
+ * typical value, or the one measured on the board.
+ * */
+#ifndef SYS_IRQ_DRIVEN
+#define	SYS_IRQ_DRIVEN		(0)
+#endif
+/* Execution model.  0 for a superloop that services the Buttons and IRRC
+ * modules on every wake; 1 for a fully interrupt-driven build in which the
+ * EXTI and LPTIM1 handlers service them directly, and the CPU sleeps on exit
+ * from every handler.
+ * */
+#ifndef SYS_SPECULATIVE
+#define	SYS_SPECULATIVE		(0)
+#endif
+/* Set to 1 to start transmitting as soon as a button press wakes the CPU,
+ * rather than once it has been debounced.  If the button is released before
+ * the debounce period ends, the transmission is aborted and the command's
+ * counter is restored.
+ * */
+#ifndef SYS_PREEMPT
+#define	SYS_PREEMPT				(0)
+#endif
+/* Set to 1 for a command to take over from a lower priority (higher numbered)
+ * one that is being transmitted, at its next frame boundary, rather than
+ * waiting for all of its frames.  The command that is cut short has still
+ * sent at least one whole frame.
+ * */
+#ifndef BUTTON_MATRIX_COLS
+#define	BUTTON_MATRIX_COLS	(0)
+#endif
+/* Number of columns of a key matrix whose four rows are the button inputs,
+ * for four keys per column (up to 4 columns on the custom board, 8 on the
+ * Nucleo), or 0 for four direct buttons.  Key n is at row n%4 of column n/4,
+ * so column 0 holds the keys that are otherwise the direct buttons.
+ * */
+#ifndef SYS_MACROS
+#define	SYS_MACROS				(0)
+#endif
+/* Set to 1 for the keys after the four commands' to send macros, each a
+ * sequence of commands; key 4 turns the fan on and speeds it up three times.
+ * Needs a key matrix.
+ * */
+#ifndef SYS_STATS
+#define	SYS_STATS					(0)
+#endif
+/* Set to 1 to count wakes, and CPU cycles spent awake, using the otherwise
+ * unused SysTick timer, and the IRED's carrier pulses and on-time; see
+ * System_GetStats() and IRRC_GetStats().  With an MSI_BURST_DIV, the
+ * cycles are a mix of the two clocks.
+ * */
+#ifndef SYS_PERSIST
+#define	SYS_PERSIST				(0)
+#endif
+/* Set to 1 to keep the commands' counters in data EEPROM, so that the first
+ * press after a reset or a battery change follows on from the last one sent,
+ * rather than starting again from 0.  They are committed once the remote has
+ * been idle for PERSIST_DELAY, just before it returns to STOP.
+ * */
+#ifndef PERSIST_DELAY
+#define	PERSIST_DELAY			(5)
+#endif
+/* Seconds after the last trigger before the counters are committed, so that
+ * a burst of presses costs a single EEPROM write.
+ * */
+#ifndef LPTIM_CLK_DIV
+#define	LPTIM_CLK_DIV			(32)
+#endif
+/* The clock divider to be applied to the LSI clock (~37kHz) that drives the
+ * system tick counter, LPTIM1.  LPTIM1 keeps counting in STOP mode, and wakes
+ * the CPU at the next button deadline, so there is no periodic tick interrupt.
+ * Must be an integral power of two in the range 1-128 (2^0-2^7).
  * */
 
 /*===============================================
@@ -29,10 +180,13 @@
  ===============================================*/
 
 typedef void (*InitButtonHW_t)(void);
-typedef int32_t (*ReadButtonHW_t)(const int32_t);
-typedef void (*InitIRRCHW_t)(uint8_t, uint8_t);
+typedef uint32_t (*ReadButtonHW_t)(void);
+typedef void (*InitIRRCHW_t)(void);
 typedef void (*SetIRRCHW_t)(const int32_t);
 typedef uint32_t (*GetClock_t)(void);
+typedef uint32_t (*ReadStoreHW_t)(int32_t);
+typedef bool (*WriteStoreHW_t)(int32_t, uint32_t);
+typedef void (*Service_t)(void);
 
 typedef union {
 	uint32_t val;
@@ -45,12 +199,48 @@ typedef union {
 		unsigned b5 : 1;
 		unsigned b6 : 1;
 		unsigned b7 : 1;
+		unsigned b8 : 1;
+		unsigned b9 : 1;
+		unsigned b10 : 1;
+		unsigned b11 : 1;
+		unsigned b12 : 1;
+		unsigned b13 : 1;
+		unsigned b14 : 1;
+		unsigned b15 : 1;
+		unsigned b16 : 1;
+		unsigned b17 : 1;
+		unsigned b18 : 1;
+		unsigned b19 : 1;
+		unsigned b20 : 1;
+		unsigned b21 : 1;
+		unsigned b22 : 1;
+		unsigned b23 : 1;
+		unsigned b24 : 1;
+		unsigned b25 : 1;
+		unsigned b26 : 1;
+		unsigned b27 : 1;
+		unsigned b28 : 1;
+		unsigned b29 : 1;
+		unsigned b30 : 1;
+		unsigned b31 : 1;
 	};
 } Triggers_t;
 
+/* Power states, from the shallowest to the deepest.  Each module reports the
+ * deepest that it can tolerate, and the CPU runs or sleeps in the shallowest
+ * of those; see System_Vote().
+ * */
+typedef enum {
+	POWER_RUN,
+	POWER_LP_RUN,			// RUN, with the regulator in low-power mode
+	POWER_SLEEP,			// CPU stopped; peripherals and Flash clocked
+	POWER_LP_SLEEP,		// SLEEP, with the regulator in low-power mode
+	POWER_STOP				// all clocks stopped but LSI; wakes on EXTI, including LPTIM1
+} PowerState_t;
+
 typedef struct {
-	const int32_t debounce;
-	const int32_t repeat;
+	const uint16_t debounce;	// ticks; see BUTTONS_SETUP()
+	const uint16_t repeat;		// ticks, or 0 for no auto-repeat
 } ButtonSetup_t;
 
 /*===============================================
@@ -92,22 +282,185 @@ typedef struct {
 	#error MSI_CLK_DIV must be an integral power of 2, in the range 1 to 64.
 #endif
 
+#ifndef MSI_BURST_DIV
+	#define MSI_BURST_DIV				(0)
+#endif
+#if MSI_BURST_DIV == 0
+	#define		MSI_BURST_RANGE		(MSI_CLK_RANGE)
+#elif MSI_BURST_DIV == 1
+	#define		MSI_BURST_RANGE		(6)
+#elif MSI_BURST_DIV == 2
+	#define		MSI_BURST_RANGE		(5)
+#elif MSI_BURST_DIV == 4
+	#define		MSI_BURST_RANGE		(4)
+#elif MSI_BURST_DIV == 8
+	#define		MSI_BURST_RANGE		(3)
+#elif MSI_BURST_DIV == 16
+	#define		MSI_BURST_RANGE		(2)
+#elif MSI_BURST_DIV == 32
+	#define		MSI_BURST_RANGE		(1)
+#else
+	#error MSI_BURST_DIV must be 0, or an integral power of 2, in the range 1 to 32.
+#endif
+#if MSI_BURST_RANGE < MSI_CLK_RANGE
+	#error MSI_BURST_DIV must not be greater than MSI_CLK_DIV.
+#endif
+
+#ifndef MSI_TX_DIV
+	#define MSI_TX_DIV					(0)
+#endif
+#if MSI_TX_DIV == 0
+	#define		MSI_TX_RANGE			(MSI_CLK_RANGE)
+#elif MSI_TX_DIV == 1
+	#define		MSI_TX_RANGE			(6)
+#elif MSI_TX_DIV == 2
+	#define		MSI_TX_RANGE			(5)
+#elif MSI_TX_DIV == 4
+	#define		MSI_TX_RANGE			(4)
+#elif MSI_TX_DIV == 8
+	#define		MSI_TX_RANGE			(3)
+#elif MSI_TX_DIV == 16
+	#define		MSI_TX_RANGE			(2)
+#elif MSI_TX_DIV == 32
+	#define		MSI_TX_RANGE			(1)
+#elif MSI_TX_DIV == 64
+	#define		MSI_TX_RANGE			(0)
+#else
+	#error MSI_TX_DIV must be 0, or an integral power of 2, in the range 1 to 64.
+#endif
+// whether the system clock is switched at all; see System_Vote()
+#if (MSI_BURST_RANGE != MSI_CLK_RANGE) || (MSI_TX_RANGE != MSI_CLK_RANGE)
+	#define	MSI_SCALING						(1)
+#else
+	#define	MSI_SCALING						(0)
+#endif
+
 #define	MSI_BASE_FREQ					(1<<22)  // 4194304Hz, approximately
 #define	SYS_CLK								(MSI_BASE_FREQ / MSI_CLK_DIV)
+#define	SYS_TX_CLK						(MSI_BASE_FREQ / (MSI_TX_DIV ? MSI_TX_DIV : MSI_CLK_DIV))
 
-#ifndef SYSTICK_MS
-	#define SYSTICK_MS					(10)
+// Low-power sleep and low-power run (regulator in low-power mode) are only
+// permitted with the system clock at or below MSI range 1 (~131kHz).  They are
+// only entered while a module votes for a state shallower than STOP, i.e. at
+// MSI_TX_DIV.
+#if MSI_TX_RANGE <= 1
+	#define	SYS_LP_SLEEP					(1)
+#else
+	#define	SYS_LP_SLEEP					(0)
+#endif
+
+#define	IR_PROTO_FAN					(0)
+#define	IR_PROTO_NEC					(1)
+#define	IR_PROTO_SIRC12				(2)
+#define	IR_PROTO_RC5					(3)
+#define	IR_PROTO_RC6					(4)
+
+#ifndef IR_CMD0_PROTOCOL
+	#define IR_CMD0_PROTOCOL		(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD0_CODE
+	#define IR_CMD0_CODE				(0x5000)
+#endif
+#ifndef IR_CMD1_PROTOCOL
+	#define IR_CMD1_PROTOCOL		(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD1_CODE
+	#define IR_CMD1_CODE				(0x50fa)
+#endif
+#ifndef IR_CMD2_PROTOCOL
+	#define IR_CMD2_PROTOCOL		(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD2_CODE
+	#define IR_CMD2_CODE				(0x5054)
+#endif
+#ifndef IR_CMD3_PROTOCOL
+	#define IR_CMD3_PROTOCOL		(IR_PROTO_FAN)
+#endif
+#ifndef IR_CMD3_CODE
+	#define IR_CMD3_CODE				(0x50a8)
+#endif
+#ifndef IR_PREBUILT
+	#define IR_PREBUILT					(1)
 #endif
-#if (SYSTICK_MS < 1)
-	#undef SYSTICK_MS
-	#define SYSTICK_MS 					(1)
-#elif (SYSTICK_MS > 100)
-	#undef SYSTICK_MS
-	#define SYSTICK_MS					(100)
+#if (IR_CMD0_PROTOCOL < IR_PROTO_FAN) || (IR_CMD0_PROTOCOL > IR_PROTO_RC6) || \
+		(IR_CMD1_PROTOCOL < IR_PROTO_FAN) || (IR_CMD1_PROTOCOL > IR_PROTO_RC6) || \
+		(IR_CMD2_PROTOCOL < IR_PROTO_FAN) || (IR_CMD2_PROTOCOL > IR_PROTO_RC6) || \
+		(IR_CMD3_PROTOCOL < IR_PROTO_FAN) || (IR_CMD3_PROTOCOL > IR_PROTO_RC6)
+	#error IR_CMDn_PROTOCOL must be one of the IR_PROTO_ options.
 #endif
-#define	SYSTICK_OVERFLOW 			((SYS_CLK * SYSTICK_MS) / 1000)
-#if (SYSTICK_OVERFLOW > 65536)
-	#error "System tick timer will overflow; reduce SYS_CLK or SYSTICK_MS"
+
+#ifndef SYS_IRQ_DRIVEN
+	#define SYS_IRQ_DRIVEN			(0)
+#endif
+#ifndef SYS_SPECULATIVE
+	#define SYS_SPECULATIVE			(0)
+#endif
+#ifndef SYS_PREEMPT
+	#define SYS_PREEMPT					(0)
+#endif
+#ifndef SYS_STATS
+	#define SYS_STATS						(0)
+#endif
+
+#ifndef BUTTON_MATRIX_COLS
+	#define BUTTON_MATRIX_COLS	(0)
+#endif
+#define	BUTTON_MATRIX_ROWS		(4)
+
+#ifndef SYS_MACROS
+	#define SYS_MACROS					(0)
+#endif
+#if SYS_MACROS && (BUTTON_MATRIX_COLS < 2)
+	#error SYS_MACROS needs a key matrix of at least 2 columns.
+#endif
+
+#ifndef LPTIM_CLK_DIV
+	#define LPTIM_CLK_DIV				(32)
+#endif
+#if LPTIM_CLK_DIV == 1
+	#define		LPTIM_CLK_PRESC		(0)
+#elif LPTIM_CLK_DIV == 2
+	#define		LPTIM_CLK_PRESC		(1)
+#elif LPTIM_CLK_DIV == 4
+	#define		LPTIM_CLK_PRESC		(2)
+#elif LPTIM_CLK_DIV == 8
+	#define		LPTIM_CLK_PRESC		(3)
+#elif LPTIM_CLK_DIV == 16
+	#define		LPTIM_CLK_PRESC		(4)
+#elif LPTIM_CLK_DIV == 32
+	#define		LPTIM_CLK_PRESC		(5)
+#elif LPTIM_CLK_DIV == 64
+	#define		LPTIM_CLK_PRESC		(6)
+#elif LPTIM_CLK_DIV == 128
+	#define		LPTIM_CLK_PRESC		(7)
+#else
+	#error LPTIM_CLK_DIV must be an integral power of 2, in the range 1 to 128.
+#endif
+
+#ifndef LSI_FREQ
+	#define LSI_FREQ						(37000)  // Hz, typical; 26-56kHz over process, voltage and temperature
+#endif
+#define	SYS_TICK_HZ						(LSI_FREQ / LPTIM_CLK_DIV)
+#define	SYS_MS_TO_TICKS(ms)		((((ms) * SYS_TICK_HZ) + 500) / 1000)
+
+#ifndef MSI_CAL_INTERVAL
+	#define MSI_CAL_INTERVAL		(0)
+#endif
+#define	MSI_CAL_TICKS					((uint32_t)MSI_CAL_INTERVAL * SYS_TICK_HZ)
+
+#ifndef SYS_PERSIST
+	#define SYS_PERSIST					(0)
+#endif
+#ifndef PERSIST_DELAY
+	#define PERSIST_DELAY				(5)
+#endif
+#define	PERSIST_TICKS					((uint32_t)PERSIST_DELAY * SYS_TICK_HZ)
+
+// System_Ticks() reads the counter until two reads agree, which needs a few
+// system clock cycles per tick, even at the fastest LSI.
+#define	LSI_MAX_FREQ					(56000)
+#if (SYS_CLK < (4 * (LSI_MAX_FREQ / LPTIM_CLK_DIV))) || (SYS_TX_CLK < (4 * (LSI_MAX_FREQ / LPTIM_CLK_DIV)))
+	#error LPTIM_CLK_DIV is too small for the system clock, with MSI_CLK_DIV or MSI_TX_DIV of 32 or more.
 #endif
 
 #endif // SRC_INC_CONFIG_H_
@@ -0,0 +1,89 @@
+#ifndef SRC_INC_IRPROTO_H_
+#define SRC_INC_IRPROTO_H_
+
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	"config.h"
+
+/*===============================================
+ public constants
+ ===============================================*/
+
+// protocol flags
+#define		IRPROTO_MSB_FIRST			(0)
+#define		IRPROTO_LSB_FIRST			(1 << 0)
+#define		IRPROTO_NONE					(0xff)
+
+/* Carrier period, in system clock cycles while transmitting (see MSI_TX_DIV),
+ * for a nominal carrier frequency in Hz.  The IR engine clocks its bitstream
+ * timer from the carrier, so all symbol durations are expressed in whole
+ * carrier cycles.
+ * */
+#define		IRPROTO_MOD_PERIOD(hz)	((uint16_t)((SYS_TX_CLK + ((hz) / 2)) / (hz)))
+/* Clock cycles of each carrier period for which the IRED is on, for a duty
+ * cycle in percent, to the nearest cycle.  The duty cycle is only
+ * representable if the IRED is then on for at least one cycle, and off for at
+ * least one.
+ * */
+#define		IRPROTO_MOD_HIGH(hz, pct)	((uint16_t)(((IRPROTO_MOD_PERIOD(hz) * (uint32_t)(pct)) + 50) / 100))
+#define		IRPROTO_DUTY_VALID(hz, pct)	((IRPROTO_MOD_HIGH(hz, pct) >= 1) && (IRPROTO_MOD_HIGH(hz, pct) < IRPROTO_MOD_PERIOD(hz)))
+/* Duration, in carrier cycles, of a time in microseconds at the carrier
+ * frequency that is actually achievable for a nominal carrier frequency in Hz.
+ * */
+#define		IRPROTO_CYCLES(us, hz)	((uint16_t)((((uint64_t)(us) * SYS_TX_CLK) + (500000ULL * IRPROTO_MOD_PERIOD(hz))) \
+																		/ (1000000ULL * IRPROTO_MOD_PERIOD(hz))))
+
+// timing of the fan protocol, which is shared with the prebuilt fan bitstreams
+#define		IRPROTO_FAN_CARRIER		(37449)		// Hz
+#define		IRPROTO_FAN_UNIT			(775)			// us
+
+/*===============================================
+ public data prototypes
+ ===============================================*/
+
+/* A pair of consecutive marks (> 0) and/or spaces (< 0), in base units.  A
+ * zero entry emits nothing.
+ * */
+typedef struct {
+	int8_t first;
+	int8_t second;
+} IRPulse_t;
+
+/* Everything the IR engine needs to synthesize frames for a protocol.
+ * Marks and spaces in consecutive pulses are merged, so biphase encodings are
+ * described simply by their two half-bit cells.
+ * */
+typedef struct {
+	uint16_t period;			// carrier period, system clock cycles (at least 2); see IRPROTO_MOD_PERIOD()
+	uint16_t high;				// clock cycles of each period for which the IRED is on; see IRPROTO_MOD_HIGH()
+	uint16_t unit;				// base unit, carrier cycles; see IRPROTO_CYCLES()
+	IRPulse_t header;			// sent before the data bits
+	IRPulse_t zero;				// encoding of a '0' data bit
+	IRPulse_t one;				// encoding of a '1' data bit
+	IRPulse_t trailer;		// sent after the data bits
+	uint8_t bits;					// number of data bits per frame
+	uint8_t flags;				// IRPROTO_MSB_FIRST or IRPROTO_LSB_FIRST
+	uint8_t wide;					// index (in transmission order) of a double-width bit, or IRPROTO_NONE
+	uint8_t frames;				// number of frames sent per command
+	IRPulse_t ditto;			// sent (with the trailer) instead of the data in frames after the first, if non-zero
+	uint16_t gap;					// minimum space after each frame, base units
+	uint16_t spacing;			// minimum time from the start of one frame to the start of the next, base units
+	uint8_t countShift;		// position of the per-command counter (or toggle bit) in the data word
+	uint8_t countMax;			// maximum value of the per-command counter; 0 for none
+} IRProtocol_t;
+
+extern const IRProtocol_t IRProto_Fan;
+extern const IRProtocol_t IRProto_NEC;
+extern const IRProtocol_t IRProto_SIRC12;
+extern const IRProtocol_t IRProto_RC5;
+extern const IRProtocol_t IRProto_RC6;
+
+/*===============================================
+ public function prototypes
+ ===============================================*/
+
+#endif // SRC_INC_IRPROTO_H_
@@ -21,7 +21,11 @@
  public function prototypes
  ===============================================*/
 
-void IRRC_Init(InitIRRCHW_t init_io, SetIRRCHW_t read_io);
+void IRRC_Init(InitIRRCHW_t init_io, SetIRRCHW_t set_io);
 bool IRRC_Service(Triggers_t triggers);
+void IRRC_Speculate(Triggers_t pressed, Triggers_t bounced);
+void IRRC_GetStats(uint32_t *sent, uint32_t *pulses, uint32_t *on);
+uint16_t IRRC_GetCounters(void);
+void IRRC_SetCounters(uint16_t counters);
 
 #endif // SRC_INC_IRRC_H_
@@ -0,0 +1,28 @@
+#ifndef SRC_INC_STORE_H_
+#define SRC_INC_STORE_H_
+
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	"config.h"
+
+/*===============================================
+ public constants
+ ===============================================*/
+
+/*===============================================
+ public data prototypes
+ ===============================================*/
+
+/*===============================================
+ public function prototypes
+ ===============================================*/
+
+void Store_Init(const ReadStoreHW_t read_hw, const WriteStoreHW_t write_hw);
+bool Store_Read(uint16_t *val);
+bool Store_Write(uint16_t val);
+
+#endif // SRC_INC_STORE_H_
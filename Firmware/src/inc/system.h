@@ -13,6 +13,11 @@
  public constants
  ===============================================*/
 
+// voters for System_Vote(), one per module
+#define	SYS_VOTER_BUTTONS		(0)
+#define	SYS_VOTER_IRRC			(1)
+#define	SYS_NUM_VOTERS			(2)
+
 /*===============================================
  public data prototypes
  ===============================================*/
@@ -23,10 +28,16 @@
 
 void System_Init(void);
 uint32_t System_Ticks(void);
-void System_Stop(void);
+bool System_SetAlarm(uint32_t ticks);
+void System_Vote(int32_t voter, PowerState_t deepest);
+bool System_Idle(void);
+void System_Run(Service_t service);
+void System_GetStats(uint32_t *wakes, uint32_t *cycles);
 void System_InitButtonIO(void);
-int32_t System_ReadButtonIO(const int32_t id);
-void System_InitIRIO(uint8_t mod_af, uint8_t level_af);
+uint32_t System_ReadButtonIO(void);
+void System_InitIRIO(void);
 void System_SetIRIO(const int32_t val);
+uint32_t System_ReadEEPROM(int32_t word);
+bool System_WriteEEPROM(int32_t word, uint32_t val);
 
 #endif // SRC_INC_SYSTEM_H_
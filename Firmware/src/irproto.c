@@ -0,0 +1,161 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	"irproto.h"
+#include	"config.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		IRPROTO_NEC_CARRIER		(38000)
+#define		IRPROTO_SIRC_CARRIER	(40000)
+#define		IRPROTO_RC_CARRIER		(36000)
+
+// carrier duty cycles, percent
+#define		IRPROTO_FAN_DUTY			(IR_CARRIER_DUTY)
+#define		IRPROTO_NEC_DUTY			(IR_CARRIER_DUTY)
+#define		IRPROTO_SIRC_DUTY			(IR_CARRIER_DUTY)
+#define		IRPROTO_RC_DUTY				(IR_CARRIER_DUTY)
+
+// each carrier needs a cycle on and a cycle off at its duty cycle, at the transmit clock
+_Static_assert(IRPROTO_DUTY_VALID(IRPROTO_FAN_CARRIER, IRPROTO_FAN_DUTY), "the fan carrier duty cycle is not representable at MSI_TX_DIV");
+_Static_assert(IRPROTO_DUTY_VALID(IRPROTO_NEC_CARRIER, IRPROTO_NEC_DUTY), "the NEC carrier duty cycle is not representable at MSI_TX_DIV");
+_Static_assert(IRPROTO_DUTY_VALID(IRPROTO_SIRC_CARRIER, IRPROTO_SIRC_DUTY), "the SIRC carrier duty cycle is not representable at MSI_TX_DIV");
+_Static_assert(IRPROTO_DUTY_VALID(IRPROTO_RC_CARRIER, IRPROTO_RC_DUTY), "the RC5/RC6 carrier duty cycle is not representable at MSI_TX_DIV");
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+/*===============================================
+ public global variables
+ ===============================================*/
+
+/* The original fan protocol: SOF of 3 active units; '0' is 1 idle + 1 active
+ * unit; '1' is 2 idle + 1 active unit; 16 bits, MSB first; two frames
+ * separated by a 134 unit IFG.  A 2-bit counter is added to the command.
+ * */
+const IRProtocol_t IRProto_Fan = {
+	.period = IRPROTO_MOD_PERIOD(IRPROTO_FAN_CARRIER),
+	.high = IRPROTO_MOD_HIGH(IRPROTO_FAN_CARRIER, IRPROTO_FAN_DUTY),
+	.unit = IRPROTO_CYCLES(IRPROTO_FAN_UNIT, IRPROTO_FAN_CARRIER),
+	.header = { 3, 0 },
+	.zero = { -1, 1 },
+	.one = { -2, 1 },
+	.trailer = { 0, 0 },
+	.bits = 16,
+	.flags = IRPROTO_MSB_FIRST,
+	.wide = IRPROTO_NONE,
+	.frames = 2,
+	.ditto = { 0, 0 },
+	.gap = 134,
+	.spacing = 0,
+	.countShift = 0,
+	.countMax = 3,
+};
+
+/* NEC: 562.5us units; 16 unit header mark, 8 unit space; pulse-distance bits;
+ * 32 bits (address, ~address, command, ~command), LSB first; stop mark.
+ * */
+const IRProtocol_t IRProto_NEC = {
+	.period = IRPROTO_MOD_PERIOD(IRPROTO_NEC_CARRIER),
+	.high = IRPROTO_MOD_HIGH(IRPROTO_NEC_CARRIER, IRPROTO_NEC_DUTY),
+	.unit = IRPROTO_CYCLES(563, IRPROTO_NEC_CARRIER),
+	.header = { 16, -8 },
+	.zero = { 1, -1 },
+	.one = { 1, -3 },
+	.trailer = { 1, 0 },
+	.bits = 32,
+	.flags = IRPROTO_LSB_FIRST,
+	.wide = IRPROTO_NONE,
+	.frames = 1,
+	.ditto = { 16, -4 },
+	.gap = 16,
+	.spacing = 192,
+	.countShift = 0,
+	.countMax = 0,
+};
+
+/* Sony SIRC, 12-bit variant: 600us units; 4 unit start mark; pulse-width bits;
+ * 7 command bits then 5 address bits, LSB first; three frames at 45ms.
+ * */
+const IRProtocol_t IRProto_SIRC12 = {
+	.period = IRPROTO_MOD_PERIOD(IRPROTO_SIRC_CARRIER),
+	.high = IRPROTO_MOD_HIGH(IRPROTO_SIRC_CARRIER, IRPROTO_SIRC_DUTY),
+	.unit = IRPROTO_CYCLES(600, IRPROTO_SIRC_CARRIER),
+	.header = { 4, -1 },
+	.zero = { 1, -1 },
+	.one = { 2, -1 },
+	.trailer = { 0, 0 },
+	.bits = 12,
+	.flags = IRPROTO_LSB_FIRST,
+	.wide = IRPROTO_NONE,
+	.frames = 3,
+	.ditto = { 0, 0 },
+	.gap = 1,
+	.spacing = 75,
+	.countShift = 0,
+	.countMax = 0,
+};
+
+/* Philips RC5: 889us half-bit cells; biphase ('1' is idle->active); 2 start
+ * bits, toggle, 5 address and 6 command bits, MSB first.  The toggle bit
+ * (bit 11) is driven by the per-command counter.
+ * */
+const IRProtocol_t IRProto_RC5 = {
+	.period = IRPROTO_MOD_PERIOD(IRPROTO_RC_CARRIER),
+	.high = IRPROTO_MOD_HIGH(IRPROTO_RC_CARRIER, IRPROTO_RC_DUTY),
+	.unit = IRPROTO_CYCLES(889, IRPROTO_RC_CARRIER),
+	.header = { 0, 0 },
+	.zero = { 1, -1 },
+	.one = { -1, 1 },
+	.trailer = { 0, 0 },
+	.bits = 14,
+	.flags = IRPROTO_MSB_FIRST,
+	.wide = IRPROTO_NONE,
+	.frames = 2,
+	.ditto = { 0, 0 },
+	.gap = 1,
+	.spacing = 128,
+	.countShift = 11,
+	.countMax = 1,
+};
+
+/* Philips RC6 mode 0: 444us half-bit cells; 6 unit leader mark, 2 unit space;
+ * biphase ('1' is active->idle); start bit, 3 mode bits, double-width toggle
+ * (trailer) bit, 8 address and 8 command bits, MSB first.  The toggle bit
+ * (bit 16) is driven by the per-command counter.
+ * */
+const IRProtocol_t IRProto_RC6 = {
+	.period = IRPROTO_MOD_PERIOD(IRPROTO_RC_CARRIER),
+	.high = IRPROTO_MOD_HIGH(IRPROTO_RC_CARRIER, IRPROTO_RC_DUTY),
+	.unit = IRPROTO_CYCLES(444, IRPROTO_RC_CARRIER),
+	.header = { 6, -2 },
+	.zero = { -1, 1 },
+	.one = { 1, -1 },
+	.trailer = { 0, 0 },
+	.bits = 21,
+	.flags = IRPROTO_MSB_FIRST,
+	.wide = 4,
+	.frames = 1,
+	.ditto = { 0, 0 },
+	.gap = 6,
+	.spacing = 0,
+	.countShift = 16,
+	.countMax = 1,
+};
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+/*===============================================
+ private functions
+ ===============================================*/
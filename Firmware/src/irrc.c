@@ -4,9 +4,11 @@
 
 #include	"stm32l0xx.h"
 #include	<stdlib.h>
+#include	<stddef.h>
 #include	<stdint.h>
 #include	<stdbool.h>
 #include	"irrc.h"
+#include	"irproto.h"
 #include	"config.h"
 #include	"utils.h"
 
@@ -15,37 +17,10 @@
  ===============================================*/
 
 // clock config
-#if MSI_CLK_DIV == 1
-	#define	IRRC_MOD_PERIOD				((uint16_t)112)
-	#define	IRRC_MOD_DUTY					((uint16_t)56)
-	#define	IRRC_BASE_PRESCALE		(IRRC_MOD_PERIOD)
-	#define	IRRC_BASE_DURATION		((uint16_t)29)
-#elif MSI_CLK_DIV == 2
-	#define	IRRC_MOD_PERIOD				((uint16_t)56)
-	#define	IRRC_MOD_DUTY					((uint16_t)28)
-	#define	IRRC_BASE_PRESCALE		(IRRC_MOD_PERIOD)
-	#define	IRRC_BASE_DURATION		((uint16_t)29)
-#elif MSI_CLK_DIV == 4
-	#define	IRRC_MOD_PERIOD				((uint16_t)28)
-	#define	IRRC_MOD_DUTY					((uint16_t)14)
-	#define	IRRC_BASE_PRESCALE		(IRRC_MOD_PERIOD)
-	#define	IRRC_BASE_DURATION		((uint16_t)29)
-#elif MSI_CLK_DIV == 8
-	#define	IRRC_MOD_PERIOD				((uint16_t)14)
-	#define	IRRC_MOD_DUTY					((uint16_t)7)
-	#define	IRRC_BASE_PRESCALE		(IRRC_MOD_PERIOD)
-	#define	IRRC_BASE_DURATION		((uint16_t)29)
-#elif MSI_CLK_DIV == 16
-	#define	IRRC_MOD_PERIOD				((uint16_t)7)
-	#define	IRRC_MOD_DUTY					((uint16_t)3)
-	#define	IRRC_BASE_PRESCALE		(IRRC_MOD_PERIOD)
-	#define	IRRC_BASE_DURATION		((uint16_t)29)
-#else
-	#error MSI_CLK_DIV must be an integral power of 2, in the range 1 to 16, for correct operation of the IR output.
-#endif
+#define	IRRC_BASE_DURATION		IRPROTO_CYCLES(IRPROTO_FAN_UNIT, IRPROTO_FAN_CARRIER)
 
 // signalling config
-#define		IRRC_MSG_SYMBOLS			((uint16_t)18)		// SOF + 16b (MSB) + IFG
+#define		IRRC_MSG_SYMBOLS			((uint16_t)19)		// SOF + 16b (MSB) + IFG, in two parts
 #define		IRRC_MSG_REPEATS			((uint16_t)2)			// 2 is how many repeats the manufacturer uses
 #define		IRRC_NUM_SYMBOLS			((uint16_t)(IRRC_MSG_SYMBOLS * IRRC_MSG_REPEATS))
 #define		IRRC_SOF_DUTY					((uint16_t)1)
@@ -54,56 +29,266 @@
 #define		IRRC_ONE_PERIOD				((IRRC_BASE_DURATION*3))
 #define		IRRC_ZERO_DUTY				((IRRC_BASE_DURATION*1))
 #define		IRRC_ZERO_PERIOD			((IRRC_BASE_DURATION*2))
-#define		IRRC_IFG_DUTY					((IRRC_BASE_DURATION*134))
 #define		IRRC_IFG_PERIOD				((IRRC_BASE_DURATION*134))
+#define		IRRC_IFG_TAIL					((IRRC_BASE_DURATION*4))	// last part of the IFG; longer than the DMA handler takes to stop
+#define		IRRC_RING_SYMBOLS			((uint16_t)16)		// DMA ring for encoded (not prebuilt) commands; two halves
+#define		IRRC_RING_HALF				((uint16_t)(IRRC_RING_SYMBOLS / 2))
+#define		IRRC_IDLE_PERIOD			((uint16_t)16)		// carrier cycles; keeps UEVs well apart while the ring drains
 
 // command config
 #define		IRRC_NUM_COMMANDS			(4)
 #define		IRRC_MAX_COUNTER			((int16_t)3)
-#define		IRRC_POWER_TOGGLE			((uint16_t)0x5000)
-#define		IRRC_ROTATE_TOGGLE		((uint16_t)0x50a8)
-#define		IRRC_SPEED_UP					((uint16_t)0x5054)
-#define		IRRC_SPEED_DOWN				((uint16_t)0x50fa)
+#define		IRRC_COUNTER_BITS			(2)								// per command, in IRRC_GetCounters()
+// descriptor for an IR_PROTO_ option, and whether its commands are prebuilt
+#define		IRRC_PROTOCOL(p)			(((p) == IR_PROTO_NEC) ? &IRProto_NEC : ((p) == IR_PROTO_SIRC12) ? &IRProto_SIRC12 : \
+																((p) == IR_PROTO_RC5) ? &IRProto_RC5 : ((p) == IR_PROTO_RC6) ? &IRProto_RC6 : &IRProto_Fan)
+#define		IRRC_PREBUILT(p)			(IR_PREBUILT && ((p) == IR_PROTO_FAN))
+#define		IRRC_QUEUE_LENGTH			((uint8_t)4)			// pending commands; must be a power of 2
+#define		IRRC_ABORT_UNITS			((uint16_t)4)			// space before restarting an aborted command; longer than any mark
+#define		IRRC_NO_COMMAND				((uint8_t)0xff)		// no urgent command
+#if SYS_MACROS
+	#define		IRRC_NUM_MACROS			(1)								// triggered by the keys after the commands'
+#else
+	#define		IRRC_NUM_MACROS			(0)
+#endif
+#define		IRRC_COUNT_NEXT				((uint8_t)0)			// macro step: advance the command's counter, as for a press
+#define		IRRC_COUNT_SAME				((uint8_t)1)			// macro step: repeat the command's last counter value
+#if SYS_PREEMPT
+	#define		IRRC_FIRST_RUN			((uint16_t)(IRRC_MSG_SYMBOLS + 1))	// symbols of a bitstream in its first DMA run; to the second SOF
+#else
+	#define		IRRC_FIRST_RUN			IRRC_NUM_SYMBOLS
+#endif
+
+// bitstream table generation
+_Static_assert(IRRC_MSG_REPEATS == 2, "IRRC_BITSTREAM() must be extended to match IRRC_MSG_REPEATS");
+_Static_assert(IRRC_MAX_COUNTER == 3, "IRRC_BITSTREAMS() must be extended to match IRRC_MAX_COUNTER");
+_Static_assert((IRRC_NUM_COMMANDS * IRRC_COUNTER_BITS) <= 16, "IRRC_GetCounters() must be widened to match IRRC_NUM_COMMANDS");
+#define		IRRC_SYMBOL(period, duty)	{ (uint16_t)(period), 0, (uint16_t)(duty) }
+#define		IRRC_BIT_DUTY(v, n)		((uint16_t)((((v) >> (n)) & 1) ? IRRC_ONE_DUTY - 1 : IRRC_ZERO_DUTY - 1))
+#define		IRRC_BIT_PERIOD(v, n)	((uint16_t)((((v) >> (n)) & 1) ? IRRC_ONE_PERIOD - 1 : IRRC_ZERO_PERIOD - 1))
+#define		IRRC_BIT(v, n)				IRRC_SYMBOL(IRRC_BIT_PERIOD(v, n), IRRC_BIT_DUTY(v, n))
+// carrier cycles of mark in a symbol, in a bit, and in a frame
+#define		IRRC_MARK(period, duty)	((uint16_t)(((duty) > (period)) ? 0 : (period) + 1 - (duty)))
+#define		IRRC_BIT_MARK(v, n)		IRRC_MARK(IRRC_BIT_PERIOD(v, n), IRRC_BIT_DUTY(v, n))
+#define		IRRC_FRAME_MARK(v) ((uint16_t)( \
+	IRRC_MARK(IRRC_SOF_PERIOD - 1, IRRC_SOF_DUTY - 1) + \
+	IRRC_BIT_MARK(v, 15) + IRRC_BIT_MARK(v, 14) + IRRC_BIT_MARK(v, 13) + IRRC_BIT_MARK(v, 12) + \
+	IRRC_BIT_MARK(v, 11) + IRRC_BIT_MARK(v, 10) + IRRC_BIT_MARK(v, 9) + IRRC_BIT_MARK(v, 8) + \
+	IRRC_BIT_MARK(v, 7) + IRRC_BIT_MARK(v, 6) + IRRC_BIT_MARK(v, 5) + IRRC_BIT_MARK(v, 4) + \
+	IRRC_BIT_MARK(v, 3) + IRRC_BIT_MARK(v, 2) + IRRC_BIT_MARK(v, 1) + IRRC_BIT_MARK(v, 0)))
+#define		IRRC_FRAME(v) \
+	IRRC_SYMBOL(IRRC_SOF_PERIOD - 1, IRRC_SOF_DUTY - 1), \
+	IRRC_BIT(v, 15), IRRC_BIT(v, 14), IRRC_BIT(v, 13), IRRC_BIT(v, 12), \
+	IRRC_BIT(v, 11), IRRC_BIT(v, 10), IRRC_BIT(v, 9), IRRC_BIT(v, 8), \
+	IRRC_BIT(v, 7), IRRC_BIT(v, 6), IRRC_BIT(v, 5), IRRC_BIT(v, 4), \
+	IRRC_BIT(v, 3), IRRC_BIT(v, 2), IRRC_BIT(v, 1), IRRC_BIT(v, 0), \
+	IRRC_SYMBOL(IRRC_IFG_PERIOD - IRRC_IFG_TAIL - 1, 0xffff), \
+	IRRC_SYMBOL(IRRC_IFG_TAIL - 1, 0xffff)
+// The IFG duty cycle never expires.  This prevents a glitch in the IR output
+// level signal.  The IFG is split so that DMA can complete as its tail starts,
+// for a more urgent command to take over there (see SYS_PREEMPT).  The tail of
+// the last IFG is never output: it gives DMA a final burst so that
+// transfer-complete coincides with the start of the last IFG.
+#define		IRRC_BITSTREAM(v) { { \
+	IRRC_FRAME(v), \
+	IRRC_FRAME(v) \
+}, IRRC_FRAME_MARK(v) }
+#define		IRRC_BITSTREAMS(v) { \
+	IRRC_BITSTREAM((v) + 0), IRRC_BITSTREAM((v) + 1), \
+	IRRC_BITSTREAM((v) + 2), IRRC_BITSTREAM((v) + 3) \
+}
+
+// TIM2 DMA burst: ARR, (RCR), CCR1 per update event
+#define		IRRC_BURST_BASE				((uint16_t)(offsetof(TIM_TypeDef, ARR) / 4))
+#define		IRRC_BURST_LENGTH			((uint16_t)(sizeof(IRRCSymbol_t) / sizeof(uint16_t)))
 
 /*===============================================
  private data prototypes
  ===============================================*/
 
-typedef struct __attribute__((__packed__)) {
-	uint16_t value;
+/* One symbol, laid out to match the TIM2 registers from ARR to CCR1 so that
+ * a single DMA burst through TIM2->DMAR loads both the period and the duty.
+ * The padding for RCR makes it 6 bytes, rather than the 4 of separate period
+ * and duty tables.
+ * */
+typedef struct {
+	uint16_t ARR;
+	uint16_t unused; // RCR, not implemented in TIM2
+	uint16_t CCR1;
+} IRRCSymbol_t;
+
+typedef struct {
+	IRRCSymbol_t Symbols[IRRC_NUM_SYMBOLS];
+	uint16_t mark; // carrier cycles of mark in each frame
+} IRRCBitstream_t;
+
+typedef struct {
+	const IRProtocol_t *protocol;
+	uint32_t value;
+	const uint8_t *data; // payload bytes, in transmission order, for frames longer than 32 bits; or 0 to use value
+	const IRRCBitstream_t *prebuilt; // one per counter value, or 0 to encode at runtime
 	int16_t count;
 } IRRCCommand_t;
 
-typedef struct __attribute__((__packed__)) {
-	uint16_t Duty[IRRC_NUM_SYMBOLS];
-	uint16_t Period[IRRC_NUM_SYMBOLS];
-} IRRCBitstream_t;
+#if SYS_MACROS
+/* One step of a macro: a command, how its counter moves, and the minimum space
+ * before it.  The space is never less than the gap that the previous command's
+ * protocol needs.
+ * */
+typedef struct {
+	uint8_t id;				// command
+	uint8_t count;		// IRRC_COUNT_NEXT or IRRC_COUNT_SAME
+	uint16_t gap;			// base units of the command's protocol, or 0
+} IRRCStep_t;
+
+typedef struct {
+	const IRRCStep_t *steps;
+	uint8_t num;
+} IRRCMacro_t;
+#endif
+
+/* State of the streaming encoder, which produces one symbol at a time so that
+ * frames of any length can be played through a small DMA ring.
+ * */
+typedef struct {
+	const IRProtocol_t *proto;
+	const uint8_t *data;
+	uint32_t value;
+	uint8_t frame;		// current frame
+	uint16_t index;		// current half-pulse within the frame; see IRRC_NextLevel()
+	uint16_t num;			// symbols produced so far
+	uint16_t space;		// leading space of the pending symbol, carrier cycles
+	uint16_t mark;		// trailing mark of the pending symbol, carrier cycles
+	uint32_t length;	// carrier cycles since the start of the current frame
+} IRRCStream_t;
+
+/* Commands waiting for the transmitter.  Single producer (IRRC_Service()),
+ * single consumer (whichever of IRRC_Service() or the DMA handler owns the
+ * transmitter, as decided by busy); head and tail are each written by one
+ * side only, so no locking is needed.
+ * */
+typedef struct {
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	volatile uint8_t cmds[IRRC_QUEUE_LENGTH];
+} IRRCQueue_t;
 
+/* A transmission started on a press that has not yet been debounced; see
+ * IRRC_Speculate().
+ * */
 typedef struct {
-	bool busy;
+	bool pending;			// not yet confirmed by a trigger, or withdrawn by a bounce
+	volatile bool live;	// still being transmitted
+	uint8_t id;
+	int16_t count;		// the command's counter before the transmission
+	uint16_t lead;		// space owed before the next start, after an abort, carrier cycles
+} IRRCSpeculation_t;
+
+typedef struct {
+	volatile bool busy;
 	InitIRRCHW_t initHW;
 	SetIRRCHW_t setHW;
 	IRRCCommand_t commands[IRRC_NUM_COMMANDS];
-	IRRCBitstream_t bitstream;
+	IRRCQueue_t queue;
+	uint8_t id; // command being transmitted
+	volatile uint8_t urgent; // command to preempt it at the next frame boundary, or IRRC_NO_COMMAND
+	const IRRCSymbol_t *frames; // the remaining frames of a prebuilt bitstream, for DMA one at a time
+	uint16_t left; // symbols remaining
+	uint16_t frameMark; // carrier cycles of mark in each of its frames
+	uint32_t sent; // transmissions started since initialization; see IRRC_GetStats()
+	uint32_t pulses; // carrier cycles of mark
+	uint32_t on; // and clock cycles of the IRED on
+	uint16_t holdoff; // space owed after the current transmission, carrier cycles
+#if SYS_MACROS
+	const IRRCStep_t *step; // next step of the macro being transmitted
+	uint8_t steps; // steps remaining
+#endif
+	bool streaming;
+	bool idle[2]; // ring half holds no symbols from the stream
+	IRRCStream_t stream;
+	IRRCSymbol_t ring[IRRC_RING_SYMBOLS];
+	IRRCSpeculation_t spec;
 } IRRCConfig_t;
 
 /*===============================================
  private function prototypes
  ===============================================*/
 
-static void IRRC_Encode(IRRCCommand_t *cmd);
-static void IRRC_Transmit();
+static bool IRRC_Enqueue(uint8_t id);
+static bool IRRC_Dequeue(uint8_t *id);
+static void IRRC_Start(uint8_t id, uint16_t lead);
+#if SYS_MACROS
+static void IRRC_Step(uint16_t lead);
+static bool IRRC_Follow(void);
+#endif
+static const IRRCSymbol_t *IRRC_Prepare(uint8_t id, uint8_t count);
+static void IRRC_Stop(void);
+static void IRRC_Next(void);
+#if SYS_MACROS || SYS_PREEMPT
+static void IRRC_Rearm(const IRRCSymbol_t *dma, uint16_t num);
+#endif
+static void IRRC_Stream(const IRRCCommand_t *cmd, uint16_t lead);
+static bool IRRC_Refill(IRRCSymbol_t *sym, uint16_t num);
+static bool IRRC_NextSymbol(IRRCSymbol_t *sym);
+static int32_t IRRC_NextLevel(void);
+static bool IRRC_NextBit(int32_t k);
+static void IRRC_Transmit(const IRProtocol_t *proto, const IRRCSymbol_t *first, uint16_t lead, const IRRCSymbol_t *dma, uint16_t num, bool circular);
+static inline void IRRC_Count(uint32_t mark);
 
 /*===============================================
  private global variables
  ===============================================*/
 
+/* Every fan bitstream that can be transmitted, for every fan command and
+ * counter value, is generated at build time and placed in Flash, from where it
+ * is read directly by DMA.  Commands for other protocols are encoded at
+ * runtime from their protocol descriptors, and take no Flash here.
+ * */
+#if IRRC_PREBUILT(IR_CMD0_PROTOCOL)
+static const IRRCBitstream_t bitstreams0[IRRC_MAX_COUNTER + 1] = IRRC_BITSTREAMS(IR_CMD0_CODE);
+	#define	IRRC_BITSTREAMS0		bitstreams0
+#else
+	#define	IRRC_BITSTREAMS0		0
+#endif
+#if IRRC_PREBUILT(IR_CMD1_PROTOCOL)
+static const IRRCBitstream_t bitstreams1[IRRC_MAX_COUNTER + 1] = IRRC_BITSTREAMS(IR_CMD1_CODE);
+	#define	IRRC_BITSTREAMS1		bitstreams1
+#else
+	#define	IRRC_BITSTREAMS1		0
+#endif
+#if IRRC_PREBUILT(IR_CMD2_PROTOCOL)
+static const IRRCBitstream_t bitstreams2[IRRC_MAX_COUNTER + 1] = IRRC_BITSTREAMS(IR_CMD2_CODE);
+	#define	IRRC_BITSTREAMS2		bitstreams2
+#else
+	#define	IRRC_BITSTREAMS2		0
+#endif
+#if IRRC_PREBUILT(IR_CMD3_PROTOCOL)
+static const IRRCBitstream_t bitstreams3[IRRC_MAX_COUNTER + 1] = IRRC_BITSTREAMS(IR_CMD3_CODE);
+	#define	IRRC_BITSTREAMS3		bitstreams3
+#else
+	#define	IRRC_BITSTREAMS3		0
+#endif
+
+#if SYS_MACROS
+/* Macros, each a sequence of commands sent for a single trigger.  Steps whose
+ * commands have prebuilt bitstreams for the same protocol are played as one
+ * continuous transmission, with only DMA rearmed between them.
+ * */
+static const IRRCStep_t macro_power_up[] = {
+	{ 0, IRRC_COUNT_NEXT, 0 }, // power toggle
+	{ 2, IRRC_COUNT_NEXT, 0 }, { 2, IRRC_COUNT_NEXT, 0 }, { 2, IRRC_COUNT_NEXT, 0 }, // speed up, x3
+};
+static const IRRCMacro_t macros[IRRC_NUM_MACROS] = {
+	{ macro_power_up, sizeof(macro_power_up) / sizeof(IRRCStep_t) },
+};
+#endif
+
 static IRRCConfig_t cfg = {
-	false, 0, 0, {
-		{ IRRC_POWER_TOGGLE, -1 },
-		{ IRRC_SPEED_DOWN, -1 },
-		{ IRRC_SPEED_UP, -1 },
-		{ IRRC_ROTATE_TOGGLE, -1 }
+	.commands = {
+		{ IRRC_PROTOCOL(IR_CMD0_PROTOCOL), IR_CMD0_CODE, 0, IRRC_BITSTREAMS0, -1 },
+		{ IRRC_PROTOCOL(IR_CMD1_PROTOCOL), IR_CMD1_CODE, 0, IRRC_BITSTREAMS1, -1 },
+		{ IRRC_PROTOCOL(IR_CMD2_PROTOCOL), IR_CMD2_CODE, 0, IRRC_BITSTREAMS2, -1 },
+		{ IRRC_PROTOCOL(IR_CMD3_PROTOCOL), IR_CMD3_CODE, 0, IRRC_BITSTREAMS3, -1 }
 	},
 };
 
@@ -116,58 +301,134 @@ void IRRC_Init(InitIRRCHW_t init_hw, SetIRRCHW_t set_hw) {
 	cfg.initHW = init_hw;
 	cfg.setHW = set_hw;
 	cfg.busy = false;
-	init_hw(5, 5);
-	// enable TIM2
+	cfg.urgent = IRRC_NO_COMMAND;
+	init_hw();
+	// enable TIM2, including in SLEEP mode
 	RCC->APB1ENR |= (1 << 0);
-	// enable TIM21
+	RCC->APB1SMENR |= (1 << 0);
+	// enable TIM21, including in SLEEP mode
 	RCC->APB2ENR |= (1 << 2);
-	// enable DMA
+	RCC->APB2SMENR |= (1 << 2);
+	// enable DMA, including in SLEEP mode
 	RCC->AHBENR |= (1 << 0);
+	RCC->AHBSMENR |= (1 << 0);
 	// configure DMA
 	DMA1_Channel2->CCR = 0;
-	DMA1_Channel5->CCR = 0;
-	DMA1->IFCR = (15<<16)+(15<<4); // clear IRQ flags for DMA1_CH5,CH2
-	DMA1_CSELR->CSELR &= ~((15<<16)+(15<<4));
-	DMA1_CSELR->CSELR |= ((8<<16)+(8<<4)); // TIM2_CH1->DMA1_CH5, TIM2_UP->DMA1_CH2
+	DMA1->IFCR = (15<<4); // clear IRQ flags for DMA1_CH2
+	DMA1_CSELR->CSELR &= ~(15<<4);
+	DMA1_CSELR->CSELR |= (8<<4); // TIM2_UP->DMA1_CH2
 	NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
 	NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0);
 	// configure TIM21
 	TIM21->CR1 = 0;
 	TIM21->SMCR = (0<<4)+(5<<0); // TS=TIM2,SMS=GATED
 	TIM21->PSC = 0;
-	TIM21->ARR = IRRC_MOD_PERIOD - 1; // ~38kHz
-	TIM21->CCR2 = IRRC_MOD_DUTY - 1; // 50% DC
-	TIM21->CCMR1 = (6<<12); // CH2:PWM1
+	TIM21->CCMR1 = (7<<12); // CH2:PWM2
 	TIM21->CCER = 0; // no output
 	TIM21->EGR = (1<<0);
 	// configure TIM2
 	TIM2->CR1 = 0;
-	TIM2->CR2 = (6<<4); // OC3REF:TRGO
+	TIM2->CR2 = (4<<4); // OC1REF:TRGO
 	TIM2->DIER = 0;
-	TIM2->PSC = IRRC_BASE_PRESCALE - 1;
-	TIM2->CCMR2 = (7<<4); // CH3:PWM2
+	TIM2->DCR = ((IRRC_BURST_LENGTH - 1)<<8)+(IRRC_BURST_BASE<<0); // DBL,DBA=ARR
+	TIM2->CCMR1 = (7<<4)+(1<<3); // CH1:PWM2,OC1PE
 	TIM2->CCER = 0;
-	TIM2->CCR3 = 0xffff;
+	TIM2->CCR1 = 0xffff;
 	TIM2->EGR = (1<<0); // UEV
 	cfg.busy = false;
 }
 
 
 bool IRRC_Service(Triggers_t triggers) {
-	int32_t i;
-	if (cfg.busy)
-		return true;
-	if (!triggers.val)
-		return false;
-	for (i = 0; i < IRRC_NUM_COMMANDS; i++) {
-		if (triggers.val & (1<<i)) {
-			cfg.busy = true;
-			IRRC_Encode(&cfg.commands[i]);
-			IRRC_Transmit();
-			return true;
+	uint8_t id;
+	for (int32_t i = 0; i < (IRRC_NUM_COMMANDS + IRRC_NUM_MACROS); i++) {
+		if (!(triggers.val & (1<<i)))
+			continue;
+		if (cfg.spec.pending && (cfg.spec.id == i))
+			cfg.spec.pending = false; // confirmed; already sent or being sent
+#if SYS_PREEMPT
+		else if (cfg.busy && (i < cfg.id) && (cfg.urgent == IRRC_NO_COMMAND))
+			cfg.urgent = i; // ahead of the queue, and of the rest of the current transmission
+#endif
+		else
+			IRRC_Enqueue(i); // dropped if the queue is full
+	}
+	// the DMA handler takes over dequeuing while a transmission is in progress
+	if (!cfg.busy && IRRC_Dequeue(&id))
+		IRRC_Start(id, 0);
+	return cfg.busy;
+}
+
+
+/* Transmit on a button press before it has been debounced.  If the
+ * transmitter is idle, the first newly pressed button's command is started
+ * straight away, and the trigger that later confirms the press is absorbed by
+ * IRRC_Service().  If the button is instead released before being debounced,
+ * the transmission is aborted, and the command's counter restored so that the
+ * next transmission repeats its value.  A restart after an abort is preceded
+ * by a space longer than any mark, so that a receiver discards the fragment.
+ * */
+void IRRC_Speculate(Triggers_t pressed, Triggers_t bounced) {
+	IRRCSpeculation_t *sp = &cfg.spec;
+	if (sp->pending && (bounced.val & (1<<sp->id))) {
+		sp->pending = false;
+		__disable_irq(); // the transmission may be ending in the DMA handler
+		if (sp->live) {
+			IRRC_Stop();
+			sp->live = false;
+			cfg.commands[sp->id].count = sp->count;
+			sp->lead = IRRC_ABORT_UNITS * cfg.commands[sp->id].protocol->unit;
+			IRRC_Next();
 		}
+		__enable_irq();
+	}
+	if (cfg.busy || sp->pending || (cfg.queue.head != cfg.queue.tail))
+		return;
+	for (uint8_t i = 0; i < IRRC_NUM_COMMANDS; i++) {
+		if (!(pressed.val & (1<<i)))
+			continue;
+		sp->pending = true;
+		sp->live = true;
+		sp->id = i;
+		sp->count = cfg.commands[i].count;
+		IRRC_Start(i, sp->lead);
+		sp->lead = 0;
+		return;
 	}
-	return false;
+}
+
+
+/* Transmissions started, carrier cycles of mark sent (each of which pulses
+ * the IRED once), and clock cycles of the IRED on (at SYS_TX_CLK), since
+ * initialization; the difference across a transmission gives its own.  Marks
+ * are counted as they are handed to DMA, so a speculative transmission that
+ * is aborted counts up to the end of its frame (prebuilt) or of the symbols
+ * encoded so far.  Always zero unless SYS_STATS is set.
+ * */
+void IRRC_GetStats(uint32_t *sent, uint32_t *pulses, uint32_t *on) {
+	*sent = cfg.sent;
+	*pulses = cfg.pulses;
+	*on = cfg.on;
+}
+
+
+/* The commands' counters, IRRC_COUNTER_BITS each, command 0 in the lowest
+ * bits, for keeping across a reset.  A command that has not been sent since
+ * initialization reads as 3, which wraps to 0 on its next press just as its
+ * initial -1 does; so do any protocol's counters that are restored out of
+ * range.  Only meaningful while nothing is being transmitted.
+ * */
+uint16_t IRRC_GetCounters(void) {
+	uint16_t counters = 0;
+	for (int32_t i = 0; i < IRRC_NUM_COMMANDS; i++)
+		counters |= (uint16_t)((cfg.commands[i].count & ((1 << IRRC_COUNTER_BITS) - 1)) << (i * IRRC_COUNTER_BITS));
+	return counters;
+}
+
+
+void IRRC_SetCounters(uint16_t counters) {
+	for (int32_t i = 0; i < IRRC_NUM_COMMANDS; i++)
+		cfg.commands[i].count = (counters >> (i * IRRC_COUNTER_BITS)) & ((1 << IRRC_COUNTER_BITS) - 1);
 }
 
 
@@ -176,91 +437,417 @@ bool IRRC_Service(Triggers_t triggers) {
  ===============================================*/
 
 void DMA1_Channel2_3_IRQHandler(void) {
+	uint32_t isr = DMA1->ISR;
+	DMA1->IFCR = (15<<4);
+	/* Streaming: refill the half of the ring that DMA has just finished with.
+	 * DMA runs one symbol ahead of the output, so transmission is complete only
+	 * once a half that holds nothing but idle symbols has been consumed.
+	 * */
+	if (cfg.streaming && !(isr & (1<<7))) { // !TEIF2
+		int32_t half = (isr & (1<<5)) ? 1 : 0; // TCIF2: 2nd half consumed, else HTIF2: 1st half
+		if (!cfg.idle[half]) {
+			cfg.idle[half] = !IRRC_Refill(&cfg.ring[half * IRRC_RING_HALF], IRRC_RING_HALF);
+			return;
+		}
+	}
+#if SYS_PREEMPT
+	/* Prebuilt: DMA plays one frame at a time, completing as the tail of its IFG
+	 * starts, with the next frame's SOF already loaded.  A more urgent command
+	 * takes over there, after the rest of the IFG; otherwise DMA carries on with
+	 * the next frame.
+	 * */
+	else if (cfg.left && !(isr & (1<<7))) { // !TEIF2
+		if (cfg.urgent >= cfg.id) {
+			uint16_t num = (cfg.left > IRRC_MSG_SYMBOLS) ? IRRC_MSG_SYMBOLS : cfg.left;
+			IRRC_Rearm(cfg.frames, num);
+			cfg.frames += num;
+			cfg.left -= num;
+			IRRC_Count(cfg.frameMark);
+			return;
+		}
+		cfg.holdoff = IRRC_IFG_TAIL;
+	}
+#if SYS_MACROS
+	if (cfg.urgent < cfg.id)
+		cfg.steps = 0; // the rest of any macro gives way too
+#endif
+#endif
+#if SYS_MACROS
+	if (cfg.steps && !(isr & (1<<7)) && IRRC_Follow())
+		return;
+#endif
+	IRRC_Stop();
+	cfg.spec.live = false;
+	IRRC_Next();
+	__SEV(); // wake System_Idle() even if this interrupt preceded its WFE
+}
+
+
+/*===============================================
+ private functions
+ ===============================================*/
+
+static bool IRRC_Enqueue(uint8_t id) {
+	uint8_t head = cfg.queue.head;
+	if ((uint8_t)(head - cfg.queue.tail) >= IRRC_QUEUE_LENGTH)
+		return false;
+	cfg.queue.cmds[head & (IRRC_QUEUE_LENGTH - 1)] = id;
+	cfg.queue.head = head + 1; // publish only once the entry is written
+	return true;
+}
+
+
+static bool IRRC_Dequeue(uint8_t *id) {
+	uint8_t tail = cfg.queue.tail;
+#if SYS_PREEMPT
+	if (cfg.urgent != IRRC_NO_COMMAND) {
+		*id = cfg.urgent;
+		cfg.urgent = IRRC_NO_COMMAND;
+		return true;
+	}
+#endif
+	if (tail == cfg.queue.head)
+		return false;
+	*id = cfg.queue.cmds[tail & (IRRC_QUEUE_LENGTH - 1)];
+	cfg.queue.tail = tail + 1;
+	return true;
+}
+
+
+/* Start transmitting a command or a macro, after a leading space of lead
+ * carrier cycles.  Called from the superloop when idle, or from the DMA
+ * handler to chain pending commands.
+ * */
+static void IRRC_Start(uint8_t id, uint16_t lead) {
+	const IRRCSymbol_t *sym;
+#if SYS_MACROS
+	if (id >= IRRC_NUM_COMMANDS) {
+		cfg.step = macros[id - IRRC_NUM_COMMANDS].steps;
+		cfg.steps = macros[id - IRRC_NUM_COMMANDS].num;
+		IRRC_Step(lead);
+		return;
+	}
+	cfg.steps = 0;
+#endif
+	sym = IRRC_Prepare(id, IRRC_COUNT_NEXT);
+	if (sym)
+		IRRC_Transmit(cfg.commands[id].protocol, sym, lead, &sym[2], IRRC_FIRST_RUN - 2, false);
+	else
+		IRRC_Stream(&cfg.commands[id], lead);
+}
+
+
+#if SYS_MACROS
+// start the next step of the macro, after lead carrier cycles or the step's own gap, whichever is longer
+static void IRRC_Step(uint16_t lead) {
+	const IRRCStep_t *st = cfg.step++;
+	const IRRCSymbol_t *sym = IRRC_Prepare(st->id, st->count);
+	uint32_t gap = (uint32_t)st->gap * cfg.commands[st->id].protocol->unit;
+	cfg.steps--;
+	if (gap > lead)
+		lead = (gap > 0xffff) ? 0xffff : gap;
+	if (sym)
+		IRRC_Transmit(cfg.commands[st->id].protocol, sym, lead, &sym[2], IRRC_FIRST_RUN - 2, false);
+	else
+		IRRC_Stream(&cfg.commands[st->id], lead);
+}
+
+
+/* Follow on from one prebuilt bitstream to the next step of a macro without
+ * stopping the timers, if that step is also prebuilt, for the same protocol.
+ * DMA completes as the last IFG starts, having loaded its tail, so it only
+ * needs pointing at the next bitstream; the tail, which is already in the
+ * TIM2 preload register, is lengthened if the step needs a longer gap.
+ * */
+static bool IRRC_Follow(void) {
+	const IRRCStep_t *st = cfg.step;
+	const IRRCCommand_t *cmd = &cfg.commands[st->id];
+	uint32_t gap = (uint32_t)st->gap * cmd->protocol->unit;
+	if (cfg.streaming || !cmd->prebuilt || (cmd->protocol != cfg.commands[cfg.id].protocol))
+		return false;
+	if (gap > IRRC_IFG_PERIOD) {
+		gap -= IRRC_IFG_PERIOD - IRRC_IFG_TAIL;
+		TIM2->ARR = ((gap > 0xffff) ? 0xffff : gap) - 1;
+	}
+	cfg.step++;
+	cfg.steps--;
+	IRRC_Rearm(IRRC_Prepare(st->id, st->count), IRRC_FIRST_RUN);
+	return true;
+}
+#endif
+
+
+/* Take the transmitter for a command, and move its counter according to count
+ * (IRRC_COUNT_NEXT or IRRC_COUNT_SAME).  Returns the prebuilt bitstream for
+ * the counter value, or 0 if the command is to be encoded.
+ * */
+static const IRRCSymbol_t *IRRC_Prepare(uint8_t id, uint8_t count) {
+	IRRCCommand_t *cmd = &cfg.commands[id];
+	uint32_t gap = (uint32_t)cmd->protocol->gap * cmd->protocol->unit;
+	const IRRCSymbol_t *sym;
+	cfg.busy = true;
+	cfg.id = id;
+	cfg.holdoff = (gap > 0xffff) ? 0xffff : gap;
+	// pre-increment command-specific counter & ensure in range
+	if (count == IRRC_COUNT_NEXT)
+		cmd->count++;
+	if ((cmd->count > cmd->protocol->countMax) || (cmd->count < 0))
+		cmd->count = 0;
+#if SYS_STATS
+	cfg.sent++;
+#endif
+	if (!cmd->prebuilt)
+		return 0;
+	sym = cmd->prebuilt[cmd->count].Symbols;
+	cfg.streaming = false;
+#if SYS_STATS
+	cfg.frameMark = cmd->prebuilt[cmd->count].mark;
+#endif
+#if SYS_PREEMPT
+	cfg.frames = &sym[IRRC_FIRST_RUN];
+	cfg.left = IRRC_NUM_SYMBOLS - IRRC_FIRST_RUN;
+	IRRC_Count(cfg.frameMark);
+#else
+	IRRC_Count((uint32_t)cfg.frameMark * IRRC_MSG_REPEATS);
+#endif
+	return sym;
+}
+
+
+// stop the timers and DMA, leaving the outputs low
+static void IRRC_Stop(void) {
 	TIM21->CCER = 0;
 	TIM2->CCER = 0;
 	TIM2->CR1 = 0;
-	TIM2->CCR3 = 0xffff;
+	TIM2->CCR1 = 0xffff;
 	TIM21->CR1 = 0;
 	DMA1_Channel2->CCR = 0;
-	DMA1_Channel5->CCR = 0;
 	TIM2->EGR = (1<<0);
-	cfg.busy = false;
-	cfg.setHW(0);
 }
 
 
-/*===============================================
- private functions
- ===============================================*/
+// start the next step of a macro, or the next pending command, straight away, after the gap owed to the last, or go idle
+static void IRRC_Next(void) {
+	uint8_t id;
+#if SYS_MACROS
+	if (cfg.steps)
+		IRRC_Step(cfg.holdoff);
+	else
+#endif
+	if (IRRC_Dequeue(&id))
+		IRRC_Start(id, cfg.holdoff);
+	else {
+		cfg.busy = false;
+		cfg.setHW(0);
+	}
+}
 
-static void IRRC_Encode(IRRCCommand_t *cmd) {
-	int16_t i, j;
-	// pre-increment command-specific counter & ensure in range
-	cmd->count++;
-	if ((cmd->count > IRRC_MAX_COUNTER) || (cmd->count < 0))
-		cmd->count = 0;
-	// calculate value to be transmitted from base + count
-	uint16_t val = cmd->value + cmd->count;
-	// construct bitstream - SOF, message bits, IFG/EOF
-	cfg.bitstream.Duty[0] = (uint16_t)IRRC_SOF_DUTY - 1;
-	cfg.bitstream.Period[0] = (uint16_t)IRRC_SOF_PERIOD - 1;
-	for (i = 0; i < 16; i++) {
-		if (val & (1<<(15-i))) {
-			cfg.bitstream.Duty[i+1] = (uint16_t)IRRC_ONE_DUTY - 1;
-			cfg.bitstream.Period[i+1] = (uint16_t)IRRC_ONE_PERIOD - 1;
-		}
+
+#if SYS_MACROS || SYS_PREEMPT
+// point DMA, which has completed, at the next num symbols, while TIM2 runs on
+static void IRRC_Rearm(const IRRCSymbol_t *dma, uint16_t num) {
+	DMA1_Channel2->CCR &= ~(1<<0);
+	DMA1_Channel2->CMAR = (uint32_t)dma;
+	DMA1_Channel2->CNDTR = (uint16_t)(num * IRRC_BURST_LENGTH);
+	DMA1_Channel2->CCR |= (1<<0);
+}
+#endif
+
+
+/* Start streaming a command that has no prebuilt bitstream.  The first two
+ * symbols are loaded into TIM2 directly, and the ring is then filled with
+ * the next IRRC_RING_SYMBOLS for DMA to play in circular mode.
+ * */
+static void IRRC_Stream(const IRRCCommand_t *cmd, uint16_t lead) {
+	IRRCSymbol_t first[2];
+	cfg.stream.proto = cmd->protocol;
+	cfg.stream.data = cmd->data;
+	cfg.stream.value = cmd->value + ((uint32_t)cmd->count << cmd->protocol->countShift);
+	cfg.stream.frame = 0;
+	cfg.stream.index = 0;
+	cfg.stream.num = 0;
+	cfg.stream.space = 0;
+	cfg.stream.mark = 0;
+	cfg.stream.length = 0;
+	IRRC_Refill(first, 2);
+	cfg.idle[0] = !IRRC_Refill(&cfg.ring[0], IRRC_RING_HALF);
+	cfg.idle[1] = !IRRC_Refill(&cfg.ring[IRRC_RING_HALF], IRRC_RING_HALF);
+	cfg.streaming = true;
+	IRRC_Transmit(cmd->protocol, first, lead, cfg.ring, IRRC_RING_SYMBOLS, true);
+}
+
+
+/* Fill num symbols from the stream, padding with idle symbols once the stream
+ * is exhausted.  Returns true if any symbols came from the stream.
+ * */
+static bool IRRC_Refill(IRRCSymbol_t *sym, uint16_t num) {
+	bool any = false;
+	for (int32_t i = 0; i < num; i++) {
+		if (IRRC_NextSymbol(&sym[i]))
+			any = true;
 		else {
-			cfg.bitstream.Duty[i+1] = (uint16_t)IRRC_ZERO_DUTY - 1;
-			cfg.bitstream.Period[i+1] = (uint16_t)IRRC_ZERO_PERIOD - 1;
+			sym[i].ARR = IRRC_IDLE_PERIOD - 1;
+			sym[i].CCR1 = 0xffff;
 		}
 	}
-	cfg.bitstream.Duty[17] = (uint16_t)IRRC_IFG_DUTY - 1;
-	cfg.bitstream.Period[17] = (uint16_t)IRRC_IFG_PERIOD - 1;
-	for (j = 1; j < IRRC_MSG_REPEATS; j++) {
-		for (i = 0; i < IRRC_MSG_SYMBOLS; i++) {
-			cfg.bitstream.Duty[i+(j*IRRC_MSG_SYMBOLS)] = cfg.bitstream.Duty[i];
-			cfg.bitstream.Period[i+(j*IRRC_MSG_SYMBOLS)] = cfg.bitstream.Period[i];
+	return any;
+}
+
+
+/* Produce the next symbol, i.e. a (possibly empty) space followed by a mark,
+ * by merging consecutive marks and spaces from the stream.  Leading spaces,
+ * and the gap after the final frame, are not transmitted.
+ * */
+static bool IRRC_NextSymbol(IRRCSymbol_t *sym) {
+	IRRCStream_t *st = &cfg.stream;
+	int32_t cycles;
+	while ((cycles = IRRC_NextLevel()) != 0) {
+		if (cycles > 0)
+			st->mark += cycles;
+		else if (st->mark)
+			break;
+		else if (st->num)
+			st->space -= cycles;
+	}
+	if (!st->mark)
+		return false;
+	sym->ARR = st->space + st->mark - 1;
+	sym->CCR1 = st->space;
+	IRRC_Count(st->mark);
+	st->num++;
+	st->space = -cycles;
+	st->mark = 0;
+	return true;
+}
+
+
+/* Return the next mark (> 0) or space (< 0) in carrier cycles, or 0 once the
+ * last frame is complete.  Each frame is a sequence of half-pulses: the two
+ * halves of the header (or ditto), two per data bit, the two halves of the
+ * trailer, then the gap.
+ * */
+static int32_t IRRC_NextLevel(void) {
+	IRRCStream_t *st = &cfg.stream;
+	const IRProtocol_t *p = st->proto;
+	while (st->frame < p->frames) {
+		bool ditto = st->frame && (p->ditto.first || p->ditto.second);
+		int32_t bits = ditto ? 0 : p->bits;
+		int32_t i = st->index++;
+		int32_t cycles;
+		if (i < 2) {
+			IRPulse_t pulse = ditto ? p->ditto : p->header;
+			cycles = (int32_t)(i ? pulse.second : pulse.first) * p->unit;
+		}
+		else if ((i -= 2) < (bits * 2)) {
+			IRPulse_t pulse = IRRC_NextBit(i / 2) ? p->one : p->zero;
+			cycles = (int32_t)((i & 1) ? pulse.second : pulse.first) * ((i / 2) == p->wide ? p->unit * 2 : p->unit);
+		}
+		else if ((i -= (bits * 2)) < 2) {
+			cycles = (int32_t)(i ? p->trailer.second : p->trailer.first) * p->unit;
+		}
+		else {
+			uint32_t gap = (uint32_t)p->gap * p->unit;
+			if (((uint32_t)p->spacing * p->unit) > (st->length + gap))
+				gap = ((uint32_t)p->spacing * p->unit) - st->length;
+			st->frame++;
+			st->index = 0;
+			st->length = 0;
+#if SYS_PREEMPT
+			if (cfg.urgent < cfg.id)
+				st->frame = p->frames; // a more urgent command takes over after this gap
+#endif
+			if (st->frame >= p->frames) {
+				cfg.holdoff = (gap > 0xffff) ? 0xffff : gap; // owed before any chained command
+				return 0;
+			}
+			return -(int32_t)(gap ? gap : 1);
+		}
+		if (cycles) {
+			st->length += (cycles > 0) ? cycles : -cycles;
+			return cycles;
 		}
 	}
-	// Ensure that the duty cycle for the last symbol for all except the last
-	// command copy never expires.  This prevents a glitch in the IR output level
-	// signal.
-	for (j = 0; j < (IRRC_MSG_REPEATS - 1); j++)
-		cfg.bitstream.Duty[17+(j*IRRC_MSG_SYMBOLS)] = 0xffff;
+	return 0;
 }
 
 
-static void IRRC_Transmit() {
-	// configure DMA - CH2 for TIM2_UP, CH5 for TIM2_CH1
-	DMA1->IFCR = (15<<12)+(15<<4);
-	// DMA1_Ch2: triggered by TIM2_UP, sets new CCR3 value (immediate effect)
+/* Value of data bit k, counted in transmission order.  Long payloads are
+ * sent byte by byte, with bits in the protocol's order within each byte.
+ * */
+static bool IRRC_NextBit(int32_t k) {
+	IRRCStream_t *st = &cfg.stream;
+	if (st->data) {
+		if (st->proto->flags & IRPROTO_LSB_FIRST)
+			return (st->data[k >> 3] >> (k & 7)) & 1;
+		return (st->data[k >> 3] >> (7 - (k & 7))) & 1;
+	}
+	if (!(st->proto->flags & IRPROTO_LSB_FIRST))
+		k = st->proto->bits - 1 - k;
+	return (k < 32) && ((st->value >> k) & 1);
+}
+
+
+/* Start transmission: the first two symbols are loaded by software, with lead
+ * carrier cycles added to the space of the first, and the remaining num
+ * symbols are loaded by DMA, either once through (with transfer-complete at
+ * the start of the last of them) or in circular mode (with an interrupt as
+ * each half is consumed).
+ * */
+static void IRRC_Transmit(const IRProtocol_t *proto, const IRRCSymbol_t *first, uint16_t lead, const IRRCSymbol_t *dma, uint16_t num, bool circular) {
+	/* TIM21 only counts while a mark gates it, and every mark is a whole number
+	 * of carrier cycles, so it stops each mark at the count it started the
+	 * first one at.  That must be 0, where the output is low: the first mark
+	 * may not start at the UEV below, before TIM2 is running, or TIM21 would
+	 * count the cycles up to TIM2's enable, and could hold the IRED on for
+	 * every space.
+	 * */
+	if (!lead && !first[0].CCR1)
+		lead = 1;
+	if (lead > (0xffff - first[0].ARR))
+		lead = 0xffff - first[0].ARR;
+	// configure DMA - CH2 for TIM2_UP, bursting through TIM2_DMAR
+	DMA1->IFCR = (15<<4);
+	// DMA1_Ch2: triggered by TIM2_UP, loads the ARR and CCR1 preload registers for the next symbol
 	DMA1_Channel2->CCR = (1<<10)+(1<<8)+(1<<7)+(1<<4)+(1<<3)+(1<<1); // MSZ=16,PSZ=16,MINC,M2P,TEIE,TCIE
-	DMA1_Channel2->CPAR = (uint32_t)&TIM2->CCR3;
-	DMA1_Channel2->CMAR = (uint32_t)&cfg.bitstream.Duty[1];
-	DMA1_Channel2->CNDTR = (uint16_t)IRRC_NUM_SYMBOLS - 1; // skip the 1st CCR3 value
-	// DMA1_Ch5: triggered by TIM2_CH1, sets new ARR value (buffered write)
-	DMA1_Channel5->CCR = (1<<10)+(1<<8)+(1<<7)+(1<<4)+(1<<3)+(1<<1); // MSZ=16,PSZ=16,MINC,M2P,TEIE,TCIE
-	DMA1_Channel5->CPAR = (uint32_t)&TIM2->ARR;
-	DMA1_Channel5->CMAR = (uint32_t)&cfg.bitstream.Period[1];
-	DMA1_Channel5->CNDTR = (uint16_t)IRRC_NUM_SYMBOLS - 1; // skip the 1st ARR value
-	// setup TIM2, including forcing a UEV and preloading the first ARR and CCR3 values
-	TIM2->CR1 = 0;
+	if (circular)
+		DMA1_Channel2->CCR |= (1<<5)+(1<<2); // CIRC,HTIE
+	DMA1_Channel2->CPAR = (uint32_t)&TIM2->DMAR;
+	DMA1_Channel2->CMAR = (uint32_t)dma;
+	DMA1_Channel2->CNDTR = (uint16_t)(num * IRRC_BURST_LENGTH);
+	// setup TIM21 for the protocol's carrier and duty cycle, high at the end of each cycle
+	TIM21->ARR = proto->period - 1;
+	TIM21->CCR2 = proto->period - proto->high;
+	// setup TIM2 to count carrier cycles, forcing a UEV to load the first symbol, then preloading the second
+	TIM2->CR1 = (1<<7); // buffer ARR
 	TIM2->DIER = 0;
+	TIM2->PSC = proto->period - 1;
+	TIM2->ARR = first[0].ARR + lead;
+	TIM2->CCR1 = (first[0].CCR1 == 0xffff) ? 0xffff : first[0].CCR1 + lead;
 	TIM2->EGR = (1<<0);
-	TIM2->CCER = (1<<8); // CCER3
-	TIM2->CCR1 = 4; // some nominal value, large enough to avoid DMA collisions, but far lower than the actual duty cycle
-	TIM2->CCR3 = cfg.bitstream.Duty[0];
-	TIM2->ARR = cfg.bitstream.Period[0];
-	TIM2->DIER = (1<<9)+(1<<8); //CC1DE,UDE
+	TIM2->ARR = first[1].ARR;
+	TIM2->CCR1 = first[1].CCR1;
+	TIM2->CCER = (1<<0); // CC1E
+	TIM2->DIER = (1<<8); // UDE
+	// the vote for SLEEP switches the system clock to MSI_TX_DIV, for which proto->period is calculated
+	cfg.setHW(1);
 	// enable TIM21
 	TIM21->CNT = 0;
 	TIM21->EGR = (1<<0);
 	TIM21->CR1 = (1<<0);
 	// enable DMA and TIM2
 	DMA1_Channel2->CCR |= (1<<0); // enable TIM2_UP DMA
-	DMA1_Channel5->CCR |= (1<<0); // enable TIM2_CH1 DMA
 	TIM21->CCER = (1<<4); // enable TIM21 output
 	TIM2->CR1 = (1<<7)+(1<<0); // buffer ARR,EN
-	cfg.setHW(1);
+}
+
+
+// count carrier cycles of mark, of the command being transmitted, for IRRC_GetStats()
+static inline void IRRC_Count(uint32_t mark) {
+#if SYS_STATS
+	cfg.pulses += mark;
+	cfg.on += mark * cfg.commands[cfg.id].protocol->high;
+#else
+	(void)mark;
+#endif
 }
 
@@ -7,11 +7,15 @@
 #include	"config.h"
 #include	"buttons.h"
 #include	"irrc.h"
+#include	"store.h"
 
 /*===============================================
  private constants
  ===============================================*/
 
+#define	NUM_BUTTONS				(sizeof(button_configs) / sizeof(ButtonSetup_t))
+#define	MATRIX_POLL_MS		(50)	// key matrix sampling while any key is held
+
 /*===============================================
  private data prototypes
  ===============================================*/
@@ -20,28 +24,68 @@
  private function prototypes
  ===============================================*/
 
+#if SYS_IRQ_DRIVEN
+static void Main_Service(void);
+#endif
+static bool Main_NextSample(bool held, uint32_t *deadline);
+static inline void Main_Speculate(void);
+static inline bool Main_Persist(Triggers_t triggers, bool busy, bool timed, uint32_t *deadline);
+
 /*===============================================
  private global variables
  ===============================================*/
 
-static const ButtonSetup_t button_configs[4] = { { 50, 0 }, { 50, 330 }, { 50, 330 }, { 50, 0 }};
+// debounce and repeat periods (ms) for each button
+static const ButtonSetup_t button_configs[] = {
+	BUTTONS_SETUP(50, 0), BUTTONS_SETUP(50, 330), BUTTONS_SETUP(50, 330), BUTTONS_SETUP(50, 0),
+#if BUTTON_MATRIX_COLS > 1
+	[BUTTON_MATRIX_ROWS ... (BUTTON_MATRIX_ROWS * BUTTON_MATRIX_COLS) - 1] = BUTTONS_SETUP(50, 0)
+#endif
+};
+static uint32_t button_deadlines[NUM_BUTTONS];
+#if SYS_PERSIST
+static bool persist_due; // the counters may have changed since they were last committed
+static uint32_t persist_deadline;
+#endif
 
 /*===============================================
  public functions
  ===============================================*/
 
 int main() {
-	Triggers_t triggers;
-	bool buttons, fan;
 	System_Init();
-	Buttons_Init(System_InitButtonIO, System_ReadButtonIO, System_Ticks, sizeof(button_configs)/sizeof(ButtonSetup_t), button_configs);
-	IRRC_Init(System_InitIRIO, System_SetIRIO);
+	Buttons_Init(System_InitButtonIO, System_ReadButtonIO, System_Ticks, NUM_BUTTONS, button_configs, button_deadlines);
+	IRRC_Init(System_InitIRIO, System_SetIRIO); // the IR engine votes through System_SetIRIO()
+#if SYS_PERSIST
+	uint16_t counters;
+	Store_Init(System_ReadEEPROM, System_WriteEEPROM);
+	if (Store_Read(&counters))
+		IRRC_SetCounters(counters);
+#endif
+	// button deadlines are met by the LPTIM1 alarm, and edges by EXTI, both of which work in STOP
+	System_Vote(SYS_VOTER_BUTTONS, POWER_STOP);
+#if SYS_IRQ_DRIVEN
+	System_Run(Main_Service);
+#else
+	Triggers_t triggers, none = { 0 };
+	bool timed = false, edge = true;
+	uint32_t deadline;
 	while (1) {
-		buttons = Buttons_Service(&triggers);
-		fan = IRRC_Service(triggers);
-		if (!buttons && !fan)
-			System_Stop();
+		// the buttons can only change on an edge, or at a deadline
+		if (edge || (timed && ((int32_t)(System_Ticks() - deadline) >= 0))) {
+			timed = Main_NextSample(Buttons_Service(&triggers), &deadline);
+			Main_Speculate();
+			timed = Main_Persist(triggers, IRRC_Service(triggers), timed, &deadline);
+			// debounce and repeat deadlines are met by an alarm, not by polling
+			if (timed && !System_SetAlarm(deadline))
+				continue; // already due
+		}
+		else
+			IRRC_Service(none); // DMA completion, while transmitting
+		// SLEEP while transmitting, to wake on DMA completion, otherwise STOP; and on the alarm or a button
+		edge = System_Idle();
 	}
+#endif
 	return 0;
 }
 
@@ -49,3 +93,83 @@ int main() {
  private functions
  ===============================================*/
 
+#if SYS_IRQ_DRIVEN
+/* One pass of the superloop, called from the button and alarm interrupt
+ * handlers.  The sleep mode on exit is set by the IR engine, via
+ * System_SetIRIO().
+ * */
+static void Main_Service(void) {
+	Triggers_t triggers;
+	bool buttons, busy;
+	uint32_t deadline;
+	do {
+		buttons = Buttons_Service(&triggers);
+		Main_Speculate();
+		busy = IRRC_Service(triggers);
+	} while (Main_Persist(triggers, busy, Main_NextSample(buttons, &deadline), &deadline) && !System_SetAlarm(deadline));
+}
+#endif
+
+
+/* The next time at which the buttons must be sampled without an edge, if
+ * any: the end of a debounce or repeat period, or, with a key matrix, the next
+ * poll while any key is held, since a held key masks the edges of any other
+ * key on its row.
+ * */
+static bool Main_NextSample(bool held, uint32_t *deadline) {
+	if (!held)
+		return false;
+	if (Buttons_NextDeadline(deadline))
+		return true;
+#if BUTTON_MATRIX_COLS
+	*deadline = System_Ticks() + BUTTONS_MS_TO_TICKS(MATRIX_POLL_MS);
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/* Start or abort a speculative transmission, on the raw button edges from
+ * the last Buttons_Service().
+ * */
+static inline void Main_Speculate(void) {
+#if SYS_SPECULATIVE
+	Triggers_t pressed, bounced;
+	Buttons_Edges(&pressed, &bounced);
+	IRRC_Speculate(pressed, bounced);
+#endif
+}
+
+
+/* Commit the commands' counters to EEPROM, PERSIST_DELAY after the last
+ * trigger, once nothing is being transmitted and no button is held: that is,
+ * just before returning to STOP.  A burst of presses costs a single write,
+ * and the programming time is kept off the press-to-IR path.  The commit's
+ * deadline is merged into the sampling deadline, if timed; returns true if
+ * there is then a deadline.  A failed commit leaves the previous record in
+ * place and is retried PERSIST_DELAY later.
+ * */
+static inline bool Main_Persist(Triggers_t triggers, bool busy, bool timed, uint32_t *deadline) {
+#if SYS_PERSIST
+	if (triggers.val) {
+		persist_due = true;
+		persist_deadline = System_Ticks() + PERSIST_TICKS;
+	}
+	if (!persist_due)
+		return timed;
+	if ((int32_t)(System_Ticks() - persist_deadline) >= 0) {
+		if (!busy && !timed && Store_Write(IRRC_GetCounters())) {
+			persist_due = false;
+			return false;
+		}
+		persist_deadline = System_Ticks() + PERSIST_TICKS; // still in use, or the write failed: retry
+	}
+	if (!timed || ((int32_t)(persist_deadline - *deadline) < 0))
+		*deadline = persist_deadline;
+	return true;
+#else
+	(void)triggers; (void)busy; (void)deadline;
+	return timed;
+#endif
+}
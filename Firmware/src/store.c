@@ -0,0 +1,103 @@
+/*===============================================
+ includes
+ ===============================================*/
+
+#include	<stdint.h>
+#include	<stdbool.h>
+#include	"store.h"
+#include	"config.h"
+#include	"utils.h"
+
+/*===============================================
+ private constants
+ ===============================================*/
+
+#define		STORE_SLOTS						(32)	// words of EEPROM in the log
+#define		STORE_SEQ(rec)				((uint8_t)((rec) >> 24))
+#define		STORE_VAL(rec)				((uint16_t)(rec))
+#define		STORE_CHECK(seq, val)	((uint8_t)(0xa5 ^ (seq) ^ (val) ^ ((val) >> 8)))
+#define		STORE_RECORD(seq, val)	(((uint32_t)(seq) << 24) + ((uint32_t)STORE_CHECK(seq, val) << 16) + (val))
+#define		STORE_VALID(rec)			((uint8_t)((rec) >> 16) == STORE_CHECK(STORE_SEQ(rec), STORE_VAL(rec)))
+_Static_assert(STORE_SLOTS < 128, "sequence numbers must span the log within half their range");
+
+/*===============================================
+ private data prototypes
+ ===============================================*/
+
+/* The store holds a single 16-bit value, as a log of records in a ring of
+ * EEPROM words.  Each commit programs the next word, so that the wear is
+ * spread over the whole ring, and a write that is cut short leaves the
+ * previous record intact.  A record is a sequence number, a check byte and the
+ * value; the latest is the valid record with the highest sequence number,
+ * which only needs comparing within the span of the ring.  The check byte
+ * rejects erased words (0), and most words that are only partly programmed.
+ * */
+typedef struct {
+	ReadStoreHW_t readHW;
+	WriteStoreHW_t writeHW;
+	int32_t head; // slot of the latest record
+	uint8_t seq;
+	uint16_t val;
+	bool valid; // any record found, or written
+} StoreConfig_t;
+
+/*===============================================
+ private function prototypes
+ ===============================================*/
+
+/*===============================================
+ private global variables
+ ===============================================*/
+
+static StoreConfig_t cfg = { 0 };
+
+/*===============================================
+ public functions
+ ===============================================*/
+
+void Store_Init(const ReadStoreHW_t read_hw, const WriteStoreHW_t write_hw) {
+	assert(read_hw && write_hw);
+	cfg.readHW = read_hw;
+	cfg.writeHW = write_hw;
+	cfg.head = STORE_SLOTS - 1; // so that an empty log starts at slot 0
+	for (int32_t i = 0; i < STORE_SLOTS; i++) {
+		uint32_t rec = read_hw(i);
+		if (!STORE_VALID(rec) || (cfg.valid && ((int8_t)(STORE_SEQ(rec) - cfg.seq) <= 0)))
+			continue;
+		cfg.head = i;
+		cfg.seq = STORE_SEQ(rec);
+		cfg.val = STORE_VAL(rec);
+		cfg.valid = true;
+	}
+}
+
+
+// the value last written, or found at initialization; false if there is none
+bool Store_Read(uint16_t *val) {
+	*val = cfg.val;
+	return cfg.valid;
+}
+
+
+/* Append a record of val to the log, unless it is already the latest.  The
+ * write takes as long as the hardware's, so is best left until nothing else
+ * is waiting.  On failure, the next write moves on to the following slot, and
+ * the previous record stands.  Returns false if the write failed.
+ * */
+bool Store_Write(uint16_t val) {
+	uint8_t seq = cfg.seq + 1;
+	if (cfg.valid && (val == cfg.val))
+		return true;
+	cfg.head = (cfg.head + 1) % STORE_SLOTS;
+	if (!cfg.writeHW(cfg.head, STORE_RECORD(seq, val)))
+		return false;
+	cfg.seq = seq;
+	cfg.val = val;
+	cfg.valid = true;
+	return true;
+}
+
+
+/*===============================================
+ private functions
+ ===============================================*/
@@ -4,236 +4,760 @@
 
 #include	"stm32l0xx.h"
 #include	"system.h"
+#include	"utils.h"
 
 /*===============================================
  private constants
  ===============================================*/
 
+#define	SYS_NUM_PORTS			(3)			// GPIOA-C
+#define	SYS_MATRIX_MAX		(8)			// key matrix columns in a pin table
+_Static_assert(BUTTON_MATRIX_COLS <= SYS_MATRIX_MAX, "too many key matrix columns");
+
+// MSI calibration: MSI cycles expected in SYS_CAL_CAPTURES captures of 8 LSI cycles, at MSI range SYS_CAL_RANGE
+#define	SYS_CAL_RANGE			(3)			// ~524kHz: fast enough to take every capture, and to resolve a step of MSITRIM
+#define	SYS_CAL_CAPTURES	(16)
+#define	SYS_CAL_TARGET		((uint32_t)((((uint64_t)(MSI_BASE_FREQ >> (6 - SYS_CAL_RANGE)) * 8 * SYS_CAL_CAPTURES) \
+														+ (LSI_FREQ / 2)) / LSI_FREQ))
+
+// data EEPROM
+#define	SYS_EEPROM_WORDS	((int32_t)((DATA_EEPROM_END + 1 - DATA_EEPROM_BASE) / 4))
+#define	SYS_EEPROM(word)	(((volatile uint32_t *)DATA_EEPROM_BASE)[word])
+#define	SYS_PEKEY1				(0x89abcdef)	// unlocks FLASH->PECR, and so the data EEPROM, with SYS_PEKEY2
+#define	SYS_PEKEY2				(0x02030405)
+#define	SYS_NVM_ERRORS		((3 << 16) + (1 << 13) + (15 << 8))	// FWWERR,NOTZEROERR,RDERR,OPTVERR,SIZERR,PGAERR,WRPERR
+
+// pin functions, which index the board's pin table
+enum {
+	SYS_PIN_RUN,				// high while the CPU is awake
+	SYS_PIN_IR_ACTIVE,	// high while the IR engine is active
+	SYS_PIN_IR_MOD,			// IR modulation output, TIM21_CH2
+	SYS_PIN_IR_LEVEL,		// IR level output, TIM2_CH1
+	SYS_PIN_BTN0,				// BTN0-3: the buttons, or key matrix rows
+	SYS_PIN_COL0 = SYS_PIN_BTN0 + BUTTON_MATRIX_ROWS,	// key matrix columns 0-7
+	SYS_PIN_SWDIO = SYS_PIN_COL0 + SYS_MATRIX_MAX,
+	SYS_PIN_SWCLK,
+	SYS_NUM_PINS
+};
+
+// SystemPin_t flags
+#define	SYS_PIN_HIGH			(1 << 0)	// output is initially high
+#define	SYS_PIN_OPEN_DRAIN	(1 << 1)
+#define	SYS_PIN_FAST			(1 << 2)	// medium speed output, for the IR signals
+#define	SYS_PIN_EXTI			(1 << 3)	// EXTI event and interrupt on both edges
+#define	SYS_PIN_KEEP			(1 << 4)	// left in its reset state, e.g. SWD
+
+// SystemPin_t initializers, by kind of pin
+#define	SYS_OUTPUT(port, pin, flags)		{ (port), (pin), 1, 0, 0, (flags) }
+#define	SYS_ALTERNATE(port, pin, af)		{ (port), (pin), 2, (af), 0, SYS_PIN_FAST }
+#define	SYS_BUTTON(port, pin)						{ (port), (pin), 0, 0, 1, SYS_PIN_EXTI } // pulled up; pressed is low
+#define	SYS_COLUMN(port, pin)						{ (port), (pin), 1, 0, 1, SYS_PIN_OPEN_DRAIN } // pulled up; driven low
+#define	SYS_DEBUG(port, pin)						{ (port), (pin), 0, 0, 0, SYS_PIN_KEEP }
+
+#define	SYS_GPIO(port)				((GPIO_TypeDef *)(GPIOA_BASE + (((port) - 'A') * (GPIOB_BASE - GPIOA_BASE))))
+#define	SYS_PORT_BIT(port)		(1 << ((port) - 'A'))
+#define	SYS_PIN_BIT(f)				(1 << sys_pins[f].pin)
+/* A pin is claimed if the board has it, and the build uses it: key matrix
+ * columns beyond BUTTON_MATRIX_COLS are unused, and parked with the rest.
+ * */
+#define	SYS_CLAIMED(f)				(sys_pins[f].port && \
+																(((f) < SYS_PIN_COL0 + BUTTON_MATRIX_COLS) || ((f) >= SYS_PIN_COL0 + SYS_MATRIX_MAX)))
+
+// drive output pin function f, if the board has it
+#define	SYS_SET_PIN(f, level)	do { \
+																if (sys_pins[f].port) \
+																	SYS_GPIO(sys_pins[f].port)->BSRR = (level) ? SYS_PIN_BIT(f) : (SYS_PIN_BIT(f) << 16); \
+															} while (0)
+
+#define	SYS_ROW_BIT(n)				(1 << sys_pins[SYS_PIN_BTN0 + (n)].pin)
+#define	SYS_BUTTON_LINES			(SYS_ROW_BIT(0) | SYS_ROW_BIT(1) | SYS_ROW_BIT(2) | SYS_ROW_BIT(3))
+#define	SYS_ROW_PORT(n)				SYS_PORT_BIT(sys_pins[SYS_PIN_BTN0 + (n)].port)
+#define	SYS_ROW_PORTS					(SYS_ROW_PORT(0) | SYS_ROW_PORT(1) | SYS_ROW_PORT(2) | SYS_ROW_PORT(3))
+#define	SYS_ROW_IDR(port)			((SYS_ROW_PORTS & SYS_PORT_BIT(port)) ? ~SYS_GPIO(port)->IDR : 0)
+#define	SYS_ROW(idr, n)				((((idr)[sys_pins[SYS_PIN_BTN0 + (n)].port - 'A'] >> sys_pins[SYS_PIN_BTN0 + (n)].pin) & 1) << (n))
+
+#define	SYS_MATRIX_GPIO				SYS_GPIO(sys_pins[SYS_PIN_COL0].port)
+#define	SYS_MATRIX_PIN(n)			(((n) < BUTTON_MATRIX_COLS) ? SYS_PIN_BIT(SYS_PIN_COL0 + (n)) : 0)
+#define	SYS_MATRIX_PINS				(SYS_MATRIX_PIN(0) + SYS_MATRIX_PIN(1) + SYS_MATRIX_PIN(2) + SYS_MATRIX_PIN(3) + \
+																 SYS_MATRIX_PIN(4) + SYS_MATRIX_PIN(5) + SYS_MATRIX_PIN(6) + SYS_MATRIX_PIN(7))
+
 /*===============================================
  private data prototypes
  ===============================================*/
 
+/* One entry of a board's pin table, which is indexed by pin function.  A
+ * function that the board does not have is left zeroed, i.e. with no port.
+ * */
+typedef struct {
+	uint8_t port;		// 'A'-'C', or 0 for none
+	uint8_t pin;		// 0-15, which is also its EXTI line
+	uint8_t mode;		// as GPIOx->MODER: 0 input, 1 output, 2 alternate function
+	uint8_t af;			// as GPIOx->AFR, for an alternate function
+	uint8_t pull;		// as GPIOx->PUPDR: 0 none, 1 pull-up, 2 pull-down
+	uint8_t flags;	// SYS_PIN_x
+} SystemPin_t;
+
 typedef struct {
-	uint32_t ticks;
+	volatile uint32_t ticks; // upper 16 bits of the tick count; see System_Ticks()
+	volatile bool alarm; // the alarm has fired since it was set, or since the last wake
+	Service_t service; // interrupt-driven builds only; see System_Run()
+	uint32_t wakes;
+	uint32_t cycles; // CPU clock cycles spent awake
+	uint32_t stamp; // SysTick value at the last wake
+	uint8_t votes[SYS_NUM_VOTERS]; // PowerState_t; see System_Vote()
+	volatile uint8_t depth; // the shallowest vote
+	uint8_t power; // the state that the hardware is configured for
+	uint32_t calibrated; // tick count at the last MSI calibration
+	uint32_t calStep; // MSI cycles per step of MSITRIM, in a measurement; see System_CalibrateMSI()
 } SystemConfig_t;
 
 /*===============================================
  private function prototypes
  ===============================================*/
 
+static void System_InitPorts(void);
+static void System_InitPins(int32_t first, int32_t last);
+static inline void System_ButtonIRQs(bool enable);
+static uint32_t System_ReadLPTIM(void);
+static void System_SetPower(PowerState_t state);
+static inline void System_SetClock(uint32_t range);
+#if MSI_CAL_INTERVAL
+static void System_CalibrateMSI(bool search);
+static uint32_t System_MeasureMSI(void);
+static inline void System_SetTrim(int32_t trim);
+#endif
+static void System_Awake(void);
+static void System_Asleep(void);
+static uint32_t System_ReadButtonRows(void);
+static bool System_ButtonEdge(void);
+#if SYS_IRQ_DRIVEN
+static void System_ButtonIRQ(void);
+#endif
+
 /*===============================================
  private global variables
  ===============================================*/
 
 static SystemConfig_t cfg = { 0 };
 
+/* The board's pins.  Every pin that is not claimed here is parked in analog
+ * mode, the lowest power state, and ports with no claimed pins are left
+ * unclocked.  Supporting a new board is a matter of adding its table.
+ * */
+#if BOARD_TYPE == BOARD_CUSTOM
+static const SystemPin_t sys_pins[SYS_NUM_PINS] = {
+	[SYS_PIN_RUN] =				SYS_OUTPUT('A', 2, SYS_PIN_HIGH),
+	[SYS_PIN_IR_ACTIVE] =	SYS_OUTPUT('A', 1, 0),
+	[SYS_PIN_IR_MOD] =		SYS_ALTERNATE('A', 3, 0),
+	[SYS_PIN_IR_LEVEL] =	SYS_ALTERNATE('A', 0, 2),
+	[SYS_PIN_BTN0] =			SYS_BUTTON('A', 9),
+	[SYS_PIN_BTN0 + 1] =	SYS_BUTTON('A', 11),
+	[SYS_PIN_BTN0 + 2] =	SYS_BUTTON('A', 10),
+	[SYS_PIN_BTN0 + 3] =	SYS_BUTTON('A', 12),
+	[SYS_PIN_COL0] =			SYS_COLUMN('A', 4),
+	[SYS_PIN_COL0 + 1] =	SYS_COLUMN('A', 5),
+	[SYS_PIN_COL0 + 2] =	SYS_COLUMN('A', 6),
+	[SYS_PIN_COL0 + 3] =	SYS_COLUMN('A', 7),
+	[SYS_PIN_SWDIO] =			SYS_DEBUG('A', 13),
+	[SYS_PIN_SWCLK] =			SYS_DEBUG('A', 14),
+};
+#elif BOARD_TYPE == BOARD_NUCLEO
+static const SystemPin_t sys_pins[SYS_NUM_PINS] = {
+	[SYS_PIN_RUN] =				SYS_OUTPUT('A', 9, SYS_PIN_HIGH),
+	[SYS_PIN_IR_ACTIVE] =	SYS_OUTPUT('B', 3, 0), // the user LED
+	[SYS_PIN_IR_MOD] =		SYS_ALTERNATE('A', 11, 5),
+	[SYS_PIN_IR_LEVEL] =	SYS_ALTERNATE('A', 0, 2),
+	[SYS_PIN_BTN0] =			SYS_BUTTON('B', 6),
+	[SYS_PIN_BTN0 + 1] =	SYS_BUTTON('A', 1),
+	[SYS_PIN_BTN0 + 2] =	SYS_BUTTON('B', 4),
+	[SYS_PIN_BTN0 + 3] =	SYS_BUTTON('B', 5),
+	[SYS_PIN_COL0] =			SYS_COLUMN('A', 4),
+	[SYS_PIN_COL0 + 1] =	SYS_COLUMN('A', 5),
+	[SYS_PIN_COL0 + 2] =	SYS_COLUMN('A', 6),
+	[SYS_PIN_COL0 + 3] =	SYS_COLUMN('A', 7),
+	[SYS_PIN_COL0 + 4] =	SYS_COLUMN('A', 8),
+	[SYS_PIN_COL0 + 5] =	SYS_COLUMN('A', 10),
+	[SYS_PIN_COL0 + 6] =	SYS_COLUMN('A', 12),
+	[SYS_PIN_COL0 + 7] =	SYS_COLUMN('A', 15),
+	[SYS_PIN_SWDIO] =			SYS_DEBUG('A', 13),
+	[SYS_PIN_SWCLK] =			SYS_DEBUG('A', 14),
+};
+#endif
+
 /*===============================================
  public functions
  ===============================================*/
 
 void System_Init(void) {
 	// set up the system clock
-	RCC->ICSCR = (RCC->ICSCR & ~(7 << 13)) | (MSI_CLK_RANGE << 13);
+	System_SetClock(MSI_BURST_RANGE);
 	// configure the system to drop in and out of STOP mode
 	FLASH->ACR |= (1 << 3); // power-down Flash in LP modes
 	RCC->APB1ENR |= (1 << 28); // PWREN
 	PWR->CR &= ~(1 << 1); // !PDDS - required to enter STOP mode
 	PWR->CR |= (1 << 16) + (3 << 11) + (1 << 9) + (1 << 2) + (0 << 1) + (1 << 0); // LDPS,VREG=Range3(1.2V),CWUF,ULP,LPDSR
 	RCC->CFGR &= ~(1 << 15); // !STOPWUK, i.e. use MSI on wakeup from STOP
-#if BOARD_TYPE == BOARD_CUSTOM
-	// STOP mode signalled on PA0
-	RCC->IOPENR |= (1 << 0);
-	RCC->IOPSMENR |= (1 << 0);
-	GPIOA->MODER &= ~(3 << 0);
-	GPIOA->MODER |= (1 << 0);
-	GPIOA->BSRR = (1 << 0); // RUN->1, STOP->0
-#else
-	  // STOP mode signalled on PA9
-	  RCC->IOPENR |= (1 << 0);
-	  RCC->IOPSMENR |= (1 << 0);
-	  GPIOA->MODER &= ~(3 << 18);
-	  GPIOA->MODER |= (1 << 18);
-	  GPIOA->BSRR = (1 << 9);// RUN->0, STOP->1
-#endif
-	// set up the systick timer
-	NVIC_EnableIRQ(SysTick_IRQn);
-	NVIC_SetPriority(SysTick_IRQn, 0);
-	SysTick->LOAD = (uint16_t)(SYSTICK_OVERFLOW - 1);
+	for (int32_t i = 0; i < SYS_NUM_VOTERS; i++)
+		cfg.votes[i] = POWER_STOP;
+	cfg.depth = POWER_STOP;
+	cfg.power = POWER_RUN;
+	// park the unused pins, and signal RUN (1) or STOP (0)
+	System_InitPorts();
+	System_InitPins(SYS_PIN_RUN, SYS_PIN_RUN);
+	// set up the system tick counter - LPTIM1, clocked by LSI so that it runs in STOP mode
+	RCC->CSR |= (1 << 0); // LSION
+	while (!(RCC->CSR & (1 << 1))); // LSIRDY
+	RCC->CCIPR = (RCC->CCIPR & ~(3 << 18)) | (1 << 18); // LPTIM1SEL=LSI
+	RCC->APB1ENR |= (1 << 31); // LPTIM1EN
+	RCC->APB1SMENR |= (1 << 31);
+	LPTIM1->CR = 0;
+	LPTIM1->CFGR = (LPTIM_CLK_PRESC << 9); // PRESC, internal clock
+	LPTIM1->IER = (1 << 1) + (1 << 0); // ARRMIE,CMPMIE
+	LPTIM1->CR = (1 << 0); // ENABLE
+	LPTIM1->ARR = 0xffff;
+	while (!(LPTIM1->ISR & (1 << 4))); // ARROK
+	LPTIM1->ICR = (1 << 4);
+	LPTIM1->CR = (1 << 2) + (1 << 0); // CNTSTRT,ENABLE
+	EXTI->IMR |= (1 << 29); // LPTIM1 wakeup from STOP
+	NVIC_EnableIRQ(LPTIM1_IRQn);
+	NVIC_SetPriority(LPTIM1_IRQn, 0);
+#if SYS_STATS
+	// SysTick free-runs on the CPU clock, with no interrupt, to time periods spent awake
+	SysTick->LOAD = 0xffffff;
 	SysTick->VAL = 0;
-	SysTick->CTRL = (1 << 2) + (1 << 1) + (1 << 0); // CPUclk(HCLK?),INTE,EN
+	SysTick->CTRL = (1 << 2) + (1 << 0); // CPUclk,EN
+	cfg.stamp = SysTick->VAL;
+#endif
+#if MSI_CAL_INTERVAL
+	// before the IR engine takes TIM21
+	System_CalibrateMSI(true);
+	cfg.calibrated = System_Ticks();
+#endif
 }
 
 uint32_t System_Ticks(void) {
-	return cfg.ticks;
+	/* cfg.ticks is advanced by the ARR match interrupt, which occurs while the
+	 * counter is at 0xffff, one tick before it wraps; the counter is offset by
+	 * one to match.  A wrap whose interrupt is still pending is counted here.
+	 * */
+	uint32_t hi, lo;
+	bool wrapped;
+	__disable_irq();
+	hi = cfg.ticks;
+	lo = (System_ReadLPTIM() + 1) & 0xffff;
+	wrapped = (LPTIM1->ISR & (1 << 1)) != 0; // ARRM
+	__enable_irq();
+	if (wrapped && (lo < 0x8000))
+		hi += 0x10000;
+	return hi + lo;
 }
 
-void System_Stop(void) {
-#if BOARD_TYPE == BOARD_CUSTOM
-	GPIOA->BSRR = (1 << 16);
-#else
-	GPIOA->BSRR = (1 << 25);
-#endif
-	SysTick->CTRL &= ~(1 << 1); // clear INTE
-	NVIC_DisableIRQ(SysTick_IRQn);
-	SCB->SCR |= (1 << 4) + (1 << 2); // SEVONPEND, SLEEPDEEP
-	__SEV();
-	__WFE();
-	__WFE();
-	SCB->SCR &= ~((1 << 4) + (1 << 2)); // !SEVONPEND, !SLEEPDEEP
-	SysTick->CTRL |= (1 << 1); // set INTE
-	NVIC_EnableIRQ(SysTick_IRQn);
-#if BOARD_TYPE == BOARD_CUSTOM
-	GPIOA->BSRR = (1 << 0);
-#else
-	GPIOA->BSRR = (1 << 9);
+bool System_SetAlarm(uint32_t ticks) {
+	/* Wake (from STOP or SLEEP) when System_Ticks() reaches ticks; deadlines
+	 * more than 0xffff ticks ahead simply wake early.  Returns false if the
+	 * deadline has already been reached, so the alarm may have been missed.
+	 * The compare register is written in the LSI domain; the write must be
+	 * complete before the next write, and before entering STOP.  That takes a
+	 * few LSI cycles whatever the system clock, so any MSI_BURST_DIV burst ends
+	 * here: the alarm is the last thing set up before STOP.
+	 * */
+#if MSI_BURST_DIV
+	if (cfg.depth == POWER_STOP)
+		System_SetClock(MSI_CLK_RANGE);
 #endif
+	cfg.alarm = false;
+	LPTIM1->CMP = (ticks - 1) & 0xffff;
+	while (!(LPTIM1->ISR & (1 << 3))); // CMPOK
+	LPTIM1->ICR = (1 << 3);
+	return (int32_t)(ticks - System_Ticks()) > 0;
 }
 
-void System_InitButtonIO(void) {
-#if BOARD_TYPE == BOARD_CUSTOM
-	// enable buttons for input - PA9-12 for the custom board
-	RCC->IOPENR |= (1 << 0);
-	RCC->IOPSMENR |= (1 << 0);
-	GPIOA->MODER &= ~((3 << 24) + (3 << 22) + (3 << 20) + (3 << 18));
-	GPIOA->PUPDR &= ~((3 << 24) + (3 << 22) + (3 << 20) + (3 << 18));
-	GPIOA->PUPDR |= ((1 << 24) + (1 << 22) + (1 << 20) + (1 << 18));
-	// enable events and interrupts on NGE of PA9-12
-	RCC->APB2ENR |= (1 << 0); // SYSCFEN
-	SYSCFG->EXTICR[2] &= ~((15 << 12) + (15 << 8) + (15 << 4)); // map PA11,10,9 to EXTI11,10,9
-	SYSCFG->EXTICR[3] &= ~(15 << 0); // map PA12 to EXTI12
-	EXTI->IMR |= ((1 << 12) + (1 << 11) + (1 << 10) + (1 << 9)); // unmask I12,11,10,9
-	EXTI->EMR |= ((1 << 12) + (1 << 11) + (1 << 10) + (1 << 9)); // unmask E12,11,10,9
-	EXTI->FTSR |= ((1 << 12) + (1 << 11) + (1 << 10) + (1 << 9)); // NGE for E/I12,11,10,9
-#else
-	  // enable buttons for input - PA0,1 and PB4,5 for the Nucleo board
-	  RCC->IOPENR |= (1 << 1) + (1 << 0);
-	  RCC->IOPSMENR |= (1 << 1) + (1 << 0);
-	  GPIOA->MODER &= ~((3 << 2) + (3 << 0));
-	  GPIOA->PUPDR &= ~((3 << 2) + (3 << 0));
-	  GPIOA->PUPDR |= (1 << 2) + (1 << 0);
-	  GPIOB->MODER &= ~((3 << 10) + (3 << 8));
-	  GPIOB->PUPDR &= ~((3 << 10) + (3 << 8));
-	  GPIOB->PUPDR |= (1 << 10) + (1 << 8);
-	  // enable events and interrupts on NGE of PA0,1 and PB4,5
-	  RCC->APB2ENR |= (1 << 0);// SYSCFEN
-	  SYSCFG->EXTICR[0] &= ~((15 << 4) + (15 << 0));
-	  SYSCFG->EXTICR[0] |= ((0 << 4) + (0 << 0));// EXTI1->PA1, EXTI0->PA0
-	  SYSCFG->EXTICR[1] &= ~((15 << 4) + (15 << 0));
-	  SYSCFG->EXTICR[1] |= ((1 << 4) + (1 << 0));// EXTI5->PB5, EXTI4->PB4
-	  EXTI->IMR |= (1 << 5) + (1 << 4) + (1 << 1) + (1 << 0);// unmask E5,4,1,0
-	  EXTI->EMR |= (1 << 5) + (1 << 4) + (1 << 1) + (1 << 0);// unmask E5,4,1,0
-	  EXTI->FTSR |= (1 << 5) + (1 << 4) + (1 << 1) + (1 << 0);// NGE for E5,4,1,0
-#endif
-}
-
-int32_t System_ReadButtonIO(const int32_t id) {
-#if BOARD_TYPE == BOARD_CUSTOM
-	/* PA9  -> BTN0
-	 * PA11 -> BTN1
-	 * PA10 -> BTN2
-	 * PA12 -> BTN3
+void System_Vote(int32_t voter, PowerState_t deepest) {
+	/* Each module reports the deepest power state that it can tolerate, and the
+	 * CPU runs or sleeps in the shallowest of those.  Low-power run and sleep
+	 * need the system clock at or below MSI range 1; otherwise they are entered
+	 * as RUN and SLEEP.  Takes effect at the next System_Idle() or, in the
+	 * interrupt-driven build, on exit from the current handler; except for the
+	 * system clock, which switches at once between MSI_CLK_DIV (or the
+	 * MSI_BURST_DIV burst) and MSI_TX_DIV, so that a module votes before
+	 * starting its timers, and stops them before voting for STOP.
 	 * */
-	switch (id) {
-		case 0:
-			return (GPIOA->IDR & (1 << 9)) == 0;
-		case 1:
-			return (GPIOA->IDR & (1 << 11)) == 0;
-		case 2:
-			return (GPIOA->IDR & (1 << 10)) == 0;
-		case 3:
-			return (GPIOA->IDR & (1 << 12)) == 0;
-		default:
-			return 0;
+	uint8_t depth = POWER_STOP;
+	cfg.votes[voter] = deepest;
+	for (int32_t i = 0; i < SYS_NUM_VOTERS; i++) {
+		if (cfg.votes[i] < depth)
+			depth = cfg.votes[i];
 	}
-#else
-	/* PA0 -> BTN0
-	 * PA1 -> BTN1
-	 * PB4 -> BTN2
-	 * PB5 -> BTN3
+#if MSI_SCALING
+	if ((depth == POWER_STOP) != (cfg.depth == POWER_STOP))
+		System_SetClock((depth == POWER_STOP) ? MSI_CLK_RANGE : MSI_TX_RANGE);
+#endif
+	cfg.depth = depth;
+#if SYS_IRQ_DRIVEN
+	if (depth != cfg.power)
+		System_SetPower(depth);
+#endif
+}
+
+bool System_Idle(void) {
+	/* Wait in the power state voted for.  In STOP, the first WFE discards stale
+	 * events, and a button edge since the last wake is still latched in
+	 * EXTI->PR, and must not be slept through: there is no periodic tick to
+	 * catch it later.  Likewise an alarm that fired after it was set, whose
+	 * interrupt has already been taken and its event discarded: the deadline may
+	 * be a single tick away, and would otherwise be slept through until the next
+	 * edge or counter wrap.  In SLEEP (while the IR engine is transmitting), the
+	 * event register is deliberately not cleared before the WFE: an event that
+	 * arrived after the caller's last check must not be discarded, and a stale
+	 * event costs only one extra pass through the superloop.  RUN and low-power run
+	 * return at once.  Returns true if a button edge is among the wake sources;
+	 * otherwise it was the alarm or DMA, and the buttons cannot have changed.
 	 * */
-	switch (id) {
-		case 0:
-		return (GPIOA->IDR & (1 << 0)) == 0;
-		case 1:
-		return (GPIOA->IDR & (1 << 1)) == 0;
-		case 2:
-		return (GPIOB->IDR & (1 << 4)) == 0;
-		case 3:
-		return (GPIOB->IDR & (1 << 5)) == 0;
-		default:
-		return 0;
+	bool edge;
+	PowerState_t state = cfg.depth;
+	if (state != cfg.power)
+		System_SetPower(state);
+	if (state <= POWER_LP_RUN)
+		return System_ButtonEdge();
+	System_Asleep();
+	if (state == POWER_STOP) {
+		SCB->SCR |= (1 << 4); // SEVONPEND
+		__SEV();
+		__WFE();
+		if (!(EXTI->PR & SYS_BUTTON_LINES) && !cfg.alarm)
+			__WFE();
+		SCB->SCR &= ~(1 << 4); // !SEVONPEND
 	}
-#endif
+	else if (!cfg.alarm)
+		__WFE();
+	cfg.alarm = false;
+	edge = System_ButtonEdge();
+	System_Awake();
+	return edge;
 }
 
-void System_InitIRIO(uint8_t mod_af, uint8_t level_af) {
-#if BOARD_TYPE == BOARD_CUSTOM
-	// enable GPIOA
-	RCC->IOPENR |= (1 << 0);
-	// configure PA3 for IR modulation output
-	GPIOA->MODER &= ~(3 << 6);
-	GPIOA->MODER |= (2 << 6);
-	GPIOA->OSPEEDR &= ~(3 << 6);
-	GPIOA->OSPEEDR |= (2 << 6);
-	GPIOA->AFR[0] &= ~(15 << 12);
-	GPIOA->AFR[0] |= (0 << 12);
-	// configure PA2 for IR level output
-	GPIOA->MODER &= ~(3 << 4);
-	GPIOA->MODER |= (2 << 4);
-	GPIOA->OSPEEDR &= ~(3 << 4);
-	GPIOA->OSPEEDR |= (2 << 4);
-	GPIOA->AFR[0] &= ~(15 << 8);
-	GPIOA->AFR[0] |= (2 << 8);
-	// configure PA1 for "IR active" signalling
-	GPIOA->MODER &= ~((3 << 2));
-	GPIOA->MODER |= (1 << 2);
-	GPIOA->BSRR = (1 << 17);
+void System_Run(Service_t service) {
+	/* Interrupt-driven execution: the EXTI (button) and LPTIM1 (alarm) handlers
+	 * call service, and the CPU goes back to sleep on exit from every handler,
+	 * without returning here.  It sleeps in the state voted for: STOP, or SLEEP
+	 * while the IR engine is transmitting; see System_Vote().  A vote for RUN
+	 * keeps it running here between handlers instead.  Does not return.
+	 * */
+	assert(service);
+	cfg.service = service;
+	EXTI->PR = SYS_BUTTON_LINES;
+	System_ButtonIRQs(true);
+	System_SetPower(cfg.depth);
+	service(); // catch anything that happened during initialization
+	System_Asleep();
+	while (1) {
+		if (cfg.depth >= POWER_SLEEP)
+			__WFI();
+	}
+}
+
+void System_GetStats(uint32_t *wakes, uint32_t *cycles) {
+	/* Number of wakes, and total CPU clock cycles spent awake, since
+	 * initialization.  Always zero unless SYS_STATS is set.
+	 * */
+	*wakes = cfg.wakes;
+	*cycles = cfg.cycles;
+}
+
+void System_InitButtonIO(void) {
+	/* The buttons, or key matrix rows, are pulled up, with events and interrupts
+	 * on both edges: a release also wakes from STOP.  Key matrix columns are
+	 * open-drain outputs, pulled up, and driven low except while being scanned,
+	 * so that a press of any key pulls its row low and wakes the CPU.  Only a
+	 * held key draws current, as with a direct button.
+	 * */
+	uint32_t lines = 0;
+	for (int32_t n = 0; n < BUTTON_MATRIX_ROWS; n++) {
+		assert(sys_pins[SYS_PIN_BTN0 + n].port && !(lines & SYS_ROW_BIT(n))); // one pin per EXTI line
+		lines |= SYS_ROW_BIT(n);
+	}
+	for (int32_t c = 0; c < BUTTON_MATRIX_COLS; c++)
+		assert(sys_pins[SYS_PIN_COL0 + c].port && (sys_pins[SYS_PIN_COL0 + c].port == sys_pins[SYS_PIN_COL0].port));
+	RCC->APB2ENR |= (1 << 0); // SYSCFEN
+	System_InitPins(SYS_PIN_BTN0, SYS_PIN_COL0 + SYS_MATRIX_MAX - 1);
+}
+
+/* The pressed buttons, as a mask with bit n set for BTNn.  With a key matrix,
+ * a scan burst drives each column low in turn, with the others released, and
+ * reads the rows (the button inputs) into four bits per column; every column
+ * is then driven low again.  The scan's own row edges are cleared from EXTI,
+ * and the rows checked against the keys found, with every column low: any
+ * difference is a change during the scan, and it is rescanned.  A row rises
+ * through its pull-up (~40k) in well under a microsecond, and is read a few
+ * CPU cycles after its column is released.
+ * */
+uint32_t System_ReadButtonIO(void) {
+#if BUTTON_MATRIX_COLS
+	uint32_t keys, held, rows;
+	do {
+		keys = 0;
+		for (int32_t c = 0; c < BUTTON_MATRIX_COLS; c++) {
+			SYS_MATRIX_GPIO->BSRR = (SYS_MATRIX_PINS & ~SYS_PIN_BIT(SYS_PIN_COL0 + c)) + (SYS_PIN_BIT(SYS_PIN_COL0 + c) << 16);
+			keys |= System_ReadButtonRows() << (BUTTON_MATRIX_ROWS * c);
+		}
+		SYS_MATRIX_GPIO->BRR = SYS_MATRIX_PINS;
+		EXTI->PR = SYS_BUTTON_LINES;
+#if SYS_IRQ_DRIVEN
+		System_ButtonIRQs(false);
+#endif
+		for (held = 0, rows = keys; rows; rows >>= BUTTON_MATRIX_ROWS)
+			held |= rows & ((1 << BUTTON_MATRIX_ROWS) - 1);
+	} while (held != System_ReadButtonRows());
+	return keys;
 #else
-	// enable GPIOA,B
-	RCC->IOPENR |= (1 << 1) + (1 << 0);
-	// configure PA11 for IR modulation output
-	GPIOA->MODER &= ~(3 << 22);
-	GPIOA->MODER |= (2 << 22);
-	GPIOA->OSPEEDR &= ~(3 << 22);
-	GPIOA->OSPEEDR |= (2 << 22);
-	GPIOA->AFR[1] &= ~(15 << 12);
-	GPIOA->AFR[1] |= (5 << 12);
-	// configure PB6 for IR level output
-	GPIOB->MODER &= ~(3 << 12);
-	GPIOB->MODER |= (2 << 12);
-	GPIOB->OSPEEDR &= ~(3 << 12);
-	GPIOB->OSPEEDR |= (2 << 12);
-	GPIOB->AFR[0] &= ~(15 << 24);
-	GPIOB->AFR[0] |= (5 << 24);
-	// configure PB3 for "IR active" signalling (via the Nucleo user LED)
-	GPIOB->MODER &= ~((3 << 6));
-	GPIOB->MODER |= (1 << 6);
-	GPIOB->BSRR = (1 << 19);
+	return System_ReadButtonRows();
 #endif
 }
 
+void System_InitIRIO(void) {
+	// the alternate functions are the board's, from its pin table
+	System_InitPins(SYS_PIN_IR_ACTIVE, SYS_PIN_IR_LEVEL);
+}
+
 void System_SetIRIO(const int32_t val) {
-#if BOARD_TYPE == BOARD_CUSTOM
-	if (val)
-		GPIOA->BSRR = (1 << 1);
-	else
-		GPIOA->BSRR = (1 << 17);
-#else
-	if (val)
-	GPIOB->BSRR = (1 << 3);
-	else
-	GPIOB->BSRR = (1 << 19);
-#endif
+	SYS_SET_PIN(SYS_PIN_IR_ACTIVE, val);
+	// while active, the IR engine's timers and DMA need their clocks, and Flash
+	System_Vote(SYS_VOTER_IRRC, val ? POWER_LP_SLEEP : POWER_STOP);
+}
+
+uint32_t System_ReadEEPROM(int32_t word) {
+	assert((word >= 0) && (word < SYS_EEPROM_WORDS));
+	return SYS_EEPROM(word);
+}
+
+bool System_WriteEEPROM(int32_t word, uint32_t val) {
+	/* Program one word of data EEPROM, waiting for it to complete: the erase
+	 * and program take ~3.2ms, at ~0.5mA, which must not overlap STOP, so the
+	 * caller keeps them off the press-to-IR path.  The data EEPROM is locked
+	 * again afterwards, so that a stray write cannot reach it.  Returns false
+	 * if the write failed.
+	 * */
+	uint32_t errors;
+	assert((word >= 0) && (word < SYS_EEPROM_WORDS));
+	FLASH->SR = SYS_NVM_ERRORS;
+	if (FLASH->PECR & (1 << 0)) { // PELOCK
+		FLASH->PEKEYR = SYS_PEKEY1;
+		FLASH->PEKEYR = SYS_PEKEY2;
+	}
+	SYS_EEPROM(word) = val;
+	while (FLASH->SR & (1 << 0)); // BSY
+	errors = FLASH->SR & SYS_NVM_ERRORS;
+	FLASH->PECR |= (1 << 0); // PELOCK
+	return !errors && (SYS_EEPROM(word) == val);
 }
 
 /*===============================================
  private functions
  ===============================================*/
 
+/* Every pin that is not claimed in the pin table is parked in analog mode,
+ * with no pull, including those of ports with no claimed pins.  Only the
+ * ports with claimed pins are then left clocked, in RUN and in SLEEP.
+ * */
+static void System_InitPorts(void) {
+	uint32_t analog[SYS_NUM_PORTS] = { ~0u, ~0u, ~0u }, ports = 0;
+	int32_t f, p;
+	for (f = 0; f < SYS_NUM_PINS; f++) {
+		if (!SYS_CLAIMED(f))
+			continue;
+		p = sys_pins[f].port - 'A';
+		assert((p < SYS_NUM_PORTS) && (sys_pins[f].pin < 16) && (analog[p] & (3u << (2 * sys_pins[f].pin)))); // one function per pin
+		analog[p] &= ~(3u << (2 * sys_pins[f].pin));
+		ports |= SYS_PORT_BIT(sys_pins[f].port);
+	}
+	RCC->IOPENR |= (1 << SYS_NUM_PORTS) - 1;
+	for (p = 0; p < SYS_NUM_PORTS; p++) {
+		SYS_GPIO('A' + p)->PUPDR &= ~analog[p];
+		SYS_GPIO('A' + p)->MODER |= analog[p];
+	}
+	RCC->IOPENR = (RCC->IOPENR & ~((1 << SYS_NUM_PORTS) - 1)) | ports;
+	RCC->IOPSMENR = (RCC->IOPSMENR & ~((1 << SYS_NUM_PORTS) - 1)) | ports;
+}
+
+/* Configure the claimed pins for functions first to last, as the pin table
+ * describes them.  An output's level is set before it is enabled.
+ * */
+static void System_InitPins(int32_t first, int32_t last) {
+	for (int32_t f = first; f <= last; f++) {
+		const SystemPin_t *p = &sys_pins[f];
+		GPIO_TypeDef *gpio = SYS_GPIO(p->port);
+		uint32_t pin = p->pin;
+		if (!SYS_CLAIMED(f) || (p->flags & SYS_PIN_KEEP))
+			continue;
+		gpio->BSRR = (p->flags & SYS_PIN_HIGH) ? (1 << pin) : (1 << (pin + 16));
+		gpio->OTYPER = (gpio->OTYPER & ~(1 << pin)) | (((p->flags & SYS_PIN_OPEN_DRAIN) ? 1 : 0) << pin);
+		gpio->OSPEEDR = (gpio->OSPEEDR & ~(3 << (2 * pin))) | (((p->flags & SYS_PIN_FAST) ? 2 : 0) << (2 * pin));
+		gpio->PUPDR = (gpio->PUPDR & ~(3 << (2 * pin))) | (p->pull << (2 * pin));
+		gpio->AFR[pin >> 3] = (gpio->AFR[pin >> 3] & ~(15 << (4 * (pin & 7)))) | (p->af << (4 * (pin & 7)));
+		gpio->MODER = (gpio->MODER & ~(3 << (2 * pin))) | (p->mode << (2 * pin));
+		if (p->flags & SYS_PIN_EXTI) {
+			SYSCFG->EXTICR[pin >> 2] = (SYSCFG->EXTICR[pin >> 2] & ~(15 << (4 * (pin & 3)))) |
+				((p->port - 'A') << (4 * (pin & 3))); // map the pin to its EXTI line
+			EXTI->IMR |= (1 << pin);
+			EXTI->EMR |= (1 << pin);
+			EXTI->FTSR |= (1 << pin);
+			EXTI->RTSR |= (1 << pin);
+		}
+	}
+}
+
+// enable the EXTI interrupts that serve the button lines, or clear them if pending
+static inline void System_ButtonIRQs(bool enable) {
+	static const IRQn_Type irqs[] = { EXTI0_1_IRQn, EXTI2_3_IRQn, EXTI4_15_IRQn };
+	static const uint16_t lines[] = { 0x0003, 0x000c, 0xfff0 };
+	for (int32_t i = 0; i < 3; i++) {
+		if (!(SYS_BUTTON_LINES & lines[i]))
+			continue;
+		if (enable) {
+			NVIC_EnableIRQ(irqs[i]);
+			NVIC_SetPriority(irqs[i], 0);
+		}
+		else
+			NVIC_ClearPendingIRQ(irqs[i]);
+	}
+}
+
+/* The button inputs, or key matrix rows, as a mask with bit n set for BTNn.
+ * Each port with a button on it is read once.
+ * */
+static uint32_t System_ReadButtonRows(void) {
+	uint32_t idr[SYS_NUM_PORTS] = { SYS_ROW_IDR('A'), SYS_ROW_IDR('B'), SYS_ROW_IDR('C') };
+	return SYS_ROW(idr, 0) + SYS_ROW(idr, 1) + SYS_ROW(idr, 2) + SYS_ROW(idr, 3);
+}
+
+static uint32_t System_ReadLPTIM(void) {
+	// the counter is clocked asynchronously, so read until two reads agree
+	uint32_t a, b;
+	b = LPTIM1->CNT;
+	do {
+		a = b;
+		b = LPTIM1->CNT;
+	} while (a != b);
+	return a;
+}
+
+/* Configure the regulator, Flash and the Cortex-M0+ sleep bits for a power
+ * state: for entering it with WFE or WFI or, for low-power run, at once.
+ * */
+static void System_SetPower(PowerState_t state) {
+#if SYS_LP_SLEEP
+	if (cfg.power == POWER_LP_RUN) {
+		PWR->CR &= ~(1 << 14); // !LPRUN
+		while (PWR->CSR & (1 << 5)); // REGLPF, i.e. until the main regulator is back
+	}
+#endif
+	switch (state) {
+#if SYS_LP_SLEEP
+		case POWER_LP_RUN:
+			PWR->CR |= (1 << 0); // LPSDSR, which must be set first
+			PWR->CR |= (1 << 14); // LPRUN
+			break;
+		case POWER_LP_SLEEP:
+			PWR->CR |= (1 << 0); // LPSDSR
+			FLASH->ACR &= ~(1 << 3); // !SLEEP_PD, i.e. Flash stays idle (not powered down) in SLEEP
+			SCB->SCR &= ~(1 << 2); // !SLEEPDEEP
+			break;
+#else
+		case POWER_LP_SLEEP: // not permitted at this system clock
+#endif
+		case POWER_SLEEP:
+			PWR->CR &= ~(1 << 0); // !LPSDSR, i.e. main regulator during SLEEP
+			FLASH->ACR &= ~(1 << 3); // !SLEEP_PD
+			SCB->SCR &= ~(1 << 2); // !SLEEPDEEP
+			break;
+		case POWER_STOP:
+			PWR->CR |= (1 << 0); // LPSDSR
+			FLASH->ACR |= (1 << 3); // SLEEP_PD, i.e. power down Flash in LP modes
+			SCB->SCR |= (1 << 2); // SLEEPDEEP
+			break;
+		default: // RUN, or low-power run where it is not permitted
+			break;
+	}
+#if SYS_IRQ_DRIVEN
+	if ((state >= POWER_SLEEP) && (cfg.power < POWER_SLEEP))
+		SCB->SCR |= (1 << 1); // SLEEPONEXIT
+	else if ((state < POWER_SLEEP) && (cfg.power >= POWER_SLEEP))
+		SCB->SCR &= ~(1 << 1); // !SLEEPONEXIT, i.e. back to System_Run()
+#endif
+	cfg.power = state;
+}
+
+/* Switch the MSI range, and so the system clock.  Only while nothing but the
+ * CPU is clocked from it, i.e. while every vote is for STOP, or on the way in
+ * or out of that.
+ * */
+static inline void System_SetClock(uint32_t range) {
+	RCC->ICSCR = (RCC->ICSCR & ~(7 << 13)) | (range << 13); // MSIRANGE
+	while (!(RCC->CR & (1 << 9))); // MSIRDY
+}
+
+#if MSI_CAL_INTERVAL
+/* Trim the MSI towards SYS_CAL_TARGET, measuring at SYS_CAL_RANGE; the trim
+ * applies to every range.  At startup, a successive approximation of MSITRIM
+ * finds the highest trim at which the MSI is not fast, and then the nearer of
+ * that and the next, measuring the size of a step on the way; thereafter, a
+ * single measurement, and a single step if it is more than half a step out.
+ * MSITRIM is signed, and searched as an offset binary value.
+ * */
+static void System_CalibrateMSI(bool search) {
+	uint32_t range = (RCC->ICSCR >> 13) & 7, count, above;
+	int32_t trim, bit;
+	System_SetClock(SYS_CAL_RANGE);
+	if (!search) {
+		trim = (int8_t)(RCC->ICSCR >> 24);
+		count = System_MeasureMSI();
+		if (((count + (cfg.calStep / 2)) < SYS_CAL_TARGET) && (trim < 127))
+			System_SetTrim(trim + 1);
+		else if ((count > (SYS_CAL_TARGET + (cfg.calStep / 2))) && (trim > -128))
+			System_SetTrim(trim - 1);
+	}
+	else {
+		trim = 0;
+		for (bit = 7; bit >= 0; bit--) {
+			System_SetTrim((trim | (1 << bit)) - 128);
+			if (System_MeasureMSI() <= SYS_CAL_TARGET)
+				trim |= (1 << bit);
+		}
+		trim -= 128;
+		System_SetTrim(trim);
+		count = System_MeasureMSI();
+		if (trim < 127) {
+			System_SetTrim(trim + 1);
+			above = System_MeasureMSI();
+			cfg.calStep = (above > count) ? above - count : 1;
+			if ((above - SYS_CAL_TARGET) > (SYS_CAL_TARGET - count))
+				System_SetTrim(trim);
+		}
+	}
+	System_SetClock(range);
+}
+
+/* MSI cycles in SYS_CAL_CAPTURES periods of 8 LSI cycles, captured by TIM21
+ * from its internal LSI input.  TIM21 is borrowed from the IR engine, which
+ * must be idle, and is left as it was found.
+ * */
+static uint32_t System_MeasureMSI(void) {
+	uint32_t enr = RCC->APB2ENR, smcr, ccmr1, arr, or, count = 0;
+	uint16_t capture, last = 0;
+	RCC->APB2ENR |= (1 << 2); // TIM21EN
+	smcr = TIM21->SMCR;
+	ccmr1 = TIM21->CCMR1;
+	arr = TIM21->ARR;
+	or = TIM21->OR;
+	TIM21->SMCR = 0; // internal clock, not gated by TIM2
+	TIM21->OR = (5 << 2); // TI1_RMP=LSI
+	TIM21->CCMR1 = (3 << 2) + (1 << 0); // IC1PSC=8,CC1S=TI1
+	TIM21->ARR = 0xffff;
+	TIM21->SR = 0;
+	TIM21->CCER = (1 << 0); // CC1E
+	TIM21->CR1 = (1 << 0); // CEN
+	for (int32_t i = 0; i <= SYS_CAL_CAPTURES; i++) {
+		while (!(TIM21->SR & (1 << 1))); // CC1IF
+		capture = TIM21->CCR1; // clears CC1IF
+		if (i > 0)
+			count += (uint16_t)(capture - last);
+		last = capture;
+	}
+	TIM21->CR1 = 0;
+	TIM21->CCER = 0;
+	TIM21->SMCR = smcr;
+	TIM21->CCMR1 = ccmr1;
+	TIM21->ARR = arr;
+	TIM21->OR = or;
+	TIM21->SR = 0;
+	RCC->APB2ENR = enr;
+	return count;
+}
+
+static inline void System_SetTrim(int32_t trim) {
+	RCC->ICSCR = (RCC->ICSCR & ~(0xffu << 24)) | ((uint32_t)(trim & 0xff) << 24); // MSITRIM
+}
+#endif
+
+/* On every wake from STOP, with an MSI_BURST_DIV, the CPU runs at the burst
+ * clock until it sets the alarm, or a module votes for a shallower state.
+ * */
+static void System_Awake(void) {
+	SYS_SET_PIN(SYS_PIN_RUN, true);
+#if MSI_BURST_DIV
+	if (cfg.depth == POWER_STOP)
+		System_SetClock(MSI_BURST_RANGE);
+#endif
+#if MSI_CAL_INTERVAL
+	// TIM21 is free whenever every vote is for STOP
+	if ((cfg.depth == POWER_STOP) && ((System_Ticks() - cfg.calibrated) >= MSI_CAL_TICKS)) {
+		System_CalibrateMSI(false);
+		cfg.calibrated = System_Ticks();
+	}
+#endif
+#if SYS_STATS
+	cfg.wakes++;
+	cfg.stamp = SysTick->VAL;
+#endif
+}
+
+static void System_Asleep(void) {
+#if SYS_STATS
+	cfg.cycles += (cfg.stamp - SysTick->VAL) & 0xffffff; // down-counter
+#endif
+	SYS_SET_PIN(SYS_PIN_RUN, false);
+}
+
+/* Whether any button line has latched an edge, clearing only the lines that
+ * are found set: an edge after the read stays latched for the next wake.  The
+ * caller reads the buttons after this.
+ * */
+static bool System_ButtonEdge(void) {
+	uint32_t pr = EXTI->PR & SYS_BUTTON_LINES;
+	EXTI->PR = pr;
+	return pr != 0;
+}
+
+#if SYS_IRQ_DRIVEN
+static void System_ButtonIRQ(void) {
+	System_Awake();
+	EXTI->PR = SYS_BUTTON_LINES;
+	cfg.service();
+	System_Asleep();
+}
+#endif
+
 /*===============================================
  interrupt handlers
  ===============================================*/
 
-void SysTick_Handler(void) {
-	cfg.ticks++;
+void LPTIM1_IRQHandler(void) {
+	uint32_t isr = LPTIM1->ISR;
+	LPTIM1->ICR = isr & ((1 << 1) + (1 << 0)); // ARRMCF,CMPMCF
+	if (isr & (1 << 1))
+		cfg.ticks += 0x10000;
+	if (isr & (1 << 0))
+		cfg.alarm = true; // for System_Idle(), in case the event was discarded
+#if SYS_IRQ_DRIVEN
+	if (isr & (1 << 0)) {
+		System_Awake();
+		cfg.service();
+		System_Asleep();
+	}
+#endif
+	// otherwise CMPM only wakes the CPU; the superloop does the rest
 }
+
+#if SYS_IRQ_DRIVEN
+void EXTI0_1_IRQHandler(void) {
+	System_ButtonIRQ();
+}
+
+void EXTI2_3_IRQHandler(void) {
+	System_ButtonIRQ();
+}
+
+void EXTI4_15_IRQHandler(void) {
+	System_ButtonIRQ();
+}
+#endif